@@ -0,0 +1,327 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "sf_simd.h"
+#include "sf_stream.h"
+#include "sf_out.h"
+#include "sf_freq.h"
+
+//one block of the key arena, keys are bumped into data[]
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t cap;
+    char   data[];
+} arena_block_t;
+
+//a table slot, empty while word is NULL
+typedef struct freq_entry {
+    const char *word;
+    uint64_t    hash;
+    size_t      len;
+    long        count;
+} freq_entry_t;
+
+typedef struct freq_table {
+    freq_entry_t  *slots;
+    size_t         cap;         //a power of 2
+    size_t         used;
+    long           total;
+    arena_block_t *arena;
+    char          *pending;     //a word cut by a chunk boundary, so far
+    size_t         pending_len;
+    size_t         pending_cap;
+    int            in_word;     //the last byte of the previous chunk was in a word
+} freq_table_t;
+
+//copies n bytes of p into the arena, returns NULL if out of memory
+static const char *arena_copy(freq_table_t *t, const char *p, size_t n){
+    arena_block_t *b = t->arena;
+
+    if (b == NULL || b->cap - b->used < n){
+        size_t cap = (n > FREQ_ARENA_BLOCK) ? n : FREQ_ARENA_BLOCK;
+
+        b = malloc(sizeof(*b) + cap);
+        if (b == NULL){
+            return NULL;
+        }
+        b->next = t->arena;
+        b->used = 0;
+        b->cap = cap;
+        t->arena = b;
+    }
+    memcpy(b->data + b->used, p, n);
+    b->used += n;
+    return b->data + b->used - n;
+}
+
+//mixes 8 bytes at a time, the tail is zero padded into one more step
+static uint64_t hash_word(const char *p, size_t n){
+    const uint64_t k = 0xff51afd7ed558ccdULL;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+    uint64_t w;
+
+    for (; n >= 8; p += 8, n -= 8){
+        memcpy(&w, p, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 32;
+    }
+    if (n > 0){
+        w = 0;
+        memcpy(&w, p, n);
+        h = (h ^ w) * k;
+    }
+    h ^= h >> 29;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 32);
+}
+
+//doubles the table, the keys stay where they are in the arena
+static int grow(freq_table_t *t){
+    size_t cap = t->cap * 2;
+    freq_entry_t *slots = calloc(cap, sizeof(*slots));
+
+    if (slots == NULL){
+        return FREQ_ERR_MEM;
+    }
+    for (size_t i = 0; i < t->cap; i++){
+        if (t->slots[i].word != NULL){
+            size_t j = t->slots[i].hash & (cap - 1);
+
+            while (slots[j].word != NULL){
+                j = (j + 1) & (cap - 1);
+            }
+            slots[j] = t->slots[i];
+        }
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->cap = cap;
+    return 0;
+}
+
+//counts one occurrence of the n byte word p
+static int intern(freq_table_t *t, const char *p, size_t n){
+    uint64_t h = hash_word(p, n);
+    size_t i = h & (t->cap - 1);
+    freq_entry_t *e;
+
+    t->total++;
+    for (e = &t->slots[i]; e->word != NULL; e = &t->slots[i]){
+        if (e->hash == h && e->len == n && memcmp(e->word, p, n) == 0){
+            e->count++;
+            return 0;
+        }
+        i = (i + 1) & (t->cap - 1);
+    }
+    if ((e->word = arena_copy(t, p, n)) == NULL){
+        return FREQ_ERR_MEM;
+    }
+    e->hash = h;
+    e->len = n;
+    e->count = 1;
+    if (++t->used * 2 > t->cap){
+        return grow(t);
+    }
+    return 0;
+}
+
+//adds n bytes of a cut word to the pending buffer
+static int pending_add(freq_table_t *t, const char *p, size_t n){
+    if (t->pending_len + n > t->pending_cap){
+        size_t cap = (t->pending_len + n) * 2;
+        char *more = realloc(t->pending, cap);
+
+        if (more == NULL){
+            return FREQ_ERR_MEM;
+        }
+        t->pending = more;
+        t->pending_cap = cap;
+    }
+    memcpy(t->pending + t->pending_len, p, n);
+    t->pending_len += n;
+    return 0;
+}
+
+//a word ending at chunk offset end, started at start in this chunk or,
+//with start -1, in an earlier one
+static int word_end(freq_table_t *t, const char *chunk, long start, size_t end){
+    int rc;
+
+    if (start >= 0){
+        return intern(t, chunk + start, end - start);
+    }
+    if ((rc = pending_add(t, chunk, end)) < 0){
+        return rc;
+    }
+    rc = intern(t, t->pending, t->pending_len);
+    t->pending_len = 0;
+    return rc;
+}
+
+//Finds the words of a chunk from its whitespace masks.  Every set bit of
+//word ^ (word << 1 | previous bit) is a boundary, a word starts there if
+//its bit in word is set and ends there otherwise, so each word costs two
+//ctz steps however long it is.
+static int freq_chunk(const char *chunk, int n, void *ctx){
+    freq_table_t *t = ctx;
+    long start = -1;            //start of the current word, -1 if in pending
+    uint64_t prev = t->in_word;
+    int rc;
+
+    for (int b = 0; b < n; b += SIMD_BLOCK){
+        int m = (n - b < SIMD_BLOCK) ? n - b : SIMD_BLOCK;
+        uint64_t valid = (m == SIMD_BLOCK) ? UINT64_MAX : ((uint64_t)1 << m) - 1;
+        uint64_t word = ~ws_mask(chunk + b, m) & valid;
+        uint64_t edges = word ^ ((word << 1) | prev);
+
+        edges &= valid;
+        while (edges != 0){
+            int pos = __builtin_ctzll(edges);
+
+            if ((word >> pos) & 1){
+                start = b + pos;
+            } else if ((rc = word_end(t, chunk, start, b + pos)) < 0){
+                return rc;
+            }
+            edges &= edges - 1;
+        }
+        prev = (word >> (m - 1)) & 1;
+    }
+    t->in_word = (int)prev;
+    if (t->in_word){
+        if (start < 0){
+            start = 0;
+        }
+        return pending_add(t, chunk + start, n - start);
+    }
+    return 0;
+}
+
+//a sorts before b in the listing: higher count, then lower bytes
+static int ranks_before(const freq_entry_t *a, const freq_entry_t *b){
+    size_t n = (a->len < b->len) ? a->len : b->len;
+    int c;
+
+    if (a->count != b->count){
+        return a->count > b->count;
+    }
+    c = memcmp(a->word, b->word, n);
+    return (c != 0) ? c < 0 : a->len < b->len;
+}
+
+//restores the heap below i, heap[0] is the entry that ranks last
+static void sift_down(freq_entry_t **heap, long n, long i){
+    for (;;){
+        long worst = i, l = 2 * i + 1, r = l + 1;
+
+        if (l < n && ranks_before(heap[worst], heap[l])){
+            worst = l;
+        }
+        if (r < n && ranks_before(heap[worst], heap[r])){
+            worst = r;
+        }
+        if (worst == i){
+            return;
+        }
+        freq_entry_t *tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+static void sift_up(freq_entry_t **heap, long i){
+    while (i > 0 && ranks_before(heap[(i - 1) / 2], heap[i])){
+        freq_entry_t *tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+//prints the k best entries of the table, best first
+static int print_top(freq_table_t *t, long k){
+    freq_entry_t **heap;
+    long n = 0;
+
+    if (k > (long)t->used){
+        k = (long)t->used;
+    }
+    heap = malloc((k > 0 ? k : 1) * sizeof(*heap));
+    if (heap == NULL){
+        return FREQ_ERR_MEM;
+    }
+    for (size_t i = 0; i < t->cap && k > 0; i++){
+        freq_entry_t *e = &t->slots[i];
+
+        if (e->word == NULL){
+            continue;
+        }
+        if (n < k){
+            heap[n] = e;
+            sift_up(heap, n++);
+        } else if (ranks_before(e, heap[0])){
+            heap[0] = e;
+            sift_down(heap, n, 0);
+        }
+    }
+    //popping the worst to the back leaves the heap sorted best first
+    for (long end = n - 1; end > 0; end--){
+        freq_entry_t *tmp = heap[0];
+        heap[0] = heap[end];
+        heap[end] = tmp;
+        sift_down(heap, end, 0);
+    }
+
+    out_str("Word Frequency\n");
+    out_str("--------------\n");
+    for (long i = 0; i < n; i++){
+        out_long(i + 1);
+        out_str(". ");
+        out_bytes(heap[i]->word, heap[i]->len);
+        out_str(" (");
+        out_long(heap[i]->count);
+        out_str(")\n");
+    }
+    out_str("Distinct words: ");
+    out_long((long)t->used);
+    out_str(", total words: ");
+    out_long(t->total);
+    out_char('\n');
+    free(heap);
+    return 0;
+}
+
+//word_freq
+//  Counts every word of fd and prints the top_k most frequent, see
+//  sf_freq.h for the output.
+//
+//  returns 0, FREQ_ERR_MEM, or a stream_chunks() error
+int word_freq(int fd, long top_k){
+    freq_table_t t = {0};
+    int rc;
+
+    t.cap = FREQ_TABLE_INIT;
+    t.slots = calloc(t.cap, sizeof(*t.slots));
+    if (t.slots == NULL){
+        return FREQ_ERR_MEM;
+    }
+    rc = stream_chunks(fd, freq_chunk, &t);
+    if (rc == 0 && t.in_word){
+        rc = intern(&t, t.pending, t.pending_len);
+    }
+    if (rc == 0){
+        rc = print_top(&t, top_k);
+    }
+
+    while (t.arena != NULL){
+        arena_block_t *next = t.arena->next;
+        free(t.arena);
+        t.arena = next;
+    }
+    free(t.pending);
+    free(t.slots);
+    return rc;
+}
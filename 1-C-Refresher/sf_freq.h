@@ -0,0 +1,30 @@
+#ifndef __SF_FREQ_H__
+    #define __SF_FREQ_H__
+
+//Word frequencies.  -f [topK] [file] streams the input (a file, or stdin
+//if none is given) through stream_chunks() and lists the topK most common
+//words, FREQ_TOP_DEFAULT if topK is left out:
+//
+//  Word Frequency
+//  --------------
+//  1. word (count)
+//  ...
+//  Distinct words: D, total words: N
+//
+//Words are interned in one pass into an open addressing hash table
+//(linear probing, doubled when half full).  A word's bytes are copied
+//once, on first sight, into a bump arena of FREQ_ARENA_BLOCK sized blocks
+//that is freed all at once.  The top K come from a K entry min heap over
+//the table, so picking them is O(D log K) with no sort of the whole
+//table.  Ties are listed in byte order of the words.
+#define FREQ_TOP_DEFAULT    10
+#define FREQ_TABLE_INIT     (1 << 12)
+#define FREQ_ARENA_BLOCK    (1 << 20)
+
+//stream_chunks() errors are passed through, see sf_stream.h
+#define FREQ_ERR_MEM        -4
+
+//prototypes for sf_freq.c
+int word_freq(int, long);
+
+#endif
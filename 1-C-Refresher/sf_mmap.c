@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sf_simd.h"
+#include "sf_stream.h"
+#include "sf_mmap.h"
+#include "sf_out.h"
+
+//maps fd read only.  An empty file maps to data NULL, len 0.
+int map_fd(int fd, file_map_t *map){
+    struct stat st;
+
+    map->data = NULL;
+    map->len = 0;
+    map->heap = 0;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)){
+        return MMAP_ERR_MAP;
+    }
+    if (st.st_size > 0){
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED){
+            return MMAP_ERR_MAP;
+        }
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        map->data = p;
+        map->len = st.st_size;
+    }
+    return 0;
+}
+
+int map_file(const char *path, file_map_t *map){
+    int fd = open(path, O_RDONLY);
+    int rc;
+
+    if (fd < 0){
+        return MMAP_ERR_OPEN;
+    }
+    rc = map_fd(fd, map);
+    close(fd);
+    return rc;
+}
+
+//reads all of fd into the heap, for pipes that cannot be mapped
+static int slurp_fd(int fd, file_map_t *map){
+    size_t cap = STREAM_CHUNK_SZ;
+    char *data = malloc(cap);
+    ssize_t n;
+
+    map->len = 0;
+    map->heap = 1;
+    while (data != NULL && (n = read(fd, data + map->len, cap - map->len)) != 0){
+        if (n < 0){
+            free(data);
+            return MMAP_ERR_MAP;
+        }
+        map->len += n;
+        if (map->len == cap){
+            char *more = realloc(data, cap *= 2);
+            if (more == NULL){
+                free(data);
+            }
+            data = more;
+        }
+    }
+    map->data = data;
+    return (data == NULL) ? MMAP_ERR_MAP : 0;
+}
+
+void unmap_file(file_map_t *map){
+    if (map->heap){
+        free((void *)map->data);
+    } else if (map->data != NULL){
+        munmap((void *)map->data, map->len);
+    }
+    map->data = NULL;
+    map->len = 0;
+}
+
+//reverse_fd
+//  Writes the input of fd to stdout reversed and normalized (reversing and
+//  normalizing commute), then a newline.  A regular file is mapped and
+//  walked backwards one STREAM_CHUNK_SZ block at a time, each block is
+//  reversed, normalized and handed to out_bytes() (one writev() for a
+//  whole block, see sf_out.h), and its pages are
+//  dropped once done so the resident set stays at a few blocks.  Other
+//  input (pipes) is read into memory first.
+//
+//  returns 0, MMAP_ERR_MAP or MMAP_ERR_WRITE
+int reverse_fd(int fd){
+    long page = sysconf(_SC_PAGESIZE);
+    int state = NORM_START;
+    file_map_t map;
+    char *rev = malloc(STREAM_CHUNK_SZ);
+    char *out = malloc(STREAM_CHUNK_SZ + 1);
+    int rc = (rev == NULL || out == NULL) ? MMAP_ERR_MAP : 0;
+
+    if (rc == 0 && map_fd(fd, &map) < 0){
+        rc = slurp_fd(fd, &map);
+    }
+
+    for (size_t end = (rc == 0) ? map.len : 0; end > 0 && rc == 0; ){
+        size_t n = (end > STREAM_CHUNK_SZ) ? STREAM_CHUNK_SZ : end;
+        size_t start = end - n;
+
+        reverse_bytes(rev, map.data + start, n);
+        out_bytes(out, normalize(out, STREAM_CHUNK_SZ + 1, rev, n, &state));
+
+        if (!map.heap){
+            size_t done = (start + page - 1) / page * page;
+            if (done < end){
+                madvise((char *)map.data + done, end - done, MADV_DONTNEED);
+            }
+        }
+        end = start;
+    }
+    if (rc == 0){
+        out_char('\n');
+        rc = (out_flush() < 0) ? MMAP_ERR_WRITE : 0;
+    }
+
+    if (rev != NULL && out != NULL){
+        unmap_file(&map);
+    }
+    free(rev);
+    free(out);
+    return rc;
+}
+
+//one thread's share of parallel_count_words()
+typedef struct count_range {
+    const char *data;
+    size_t      start;
+    size_t      end;
+    long        words;
+    pthread_t   tid;
+} count_range_t;
+
+static void *count_range_main(void *arg){
+    count_range_t *r = arg;
+    //a range that starts inside a word leaves that word to the range
+    //before it
+    int in_word = (r->start > 0) && !(ws_mask(r->data + r->start - 1, 1) & 1);
+
+    r->words = count_words_len(r->data + r->start, r->end - r->start, &in_word);
+    return NULL;
+}
+
+//parallel_count_words
+//  Counts the words of the file at path on nthreads threads, each taking
+//  one byte range of a mapping of the file.
+//
+//  returns the word count, or MMAP_ERR_OPEN, MMAP_ERR_MAP or
+//  MMAP_ERR_THREAD
+long parallel_count_words(const char *path, int nthreads){
+    count_range_t *ranges;
+    file_map_t map;
+    long words = 0;
+    int started = 0;
+    int rc;
+
+    if ((rc = map_file(path, &map)) < 0){
+        return rc;
+    }
+    //ranges shorter than a block are not worth a thread
+    if ((size_t)nthreads > map.len / SIMD_BLOCK){
+        nthreads = (map.len / SIMD_BLOCK > 0) ? (int)(map.len / SIMD_BLOCK) : 1;
+    }
+    ranges = calloc(nthreads, sizeof(count_range_t));
+    if (ranges == NULL){
+        unmap_file(&map);
+        return MMAP_ERR_THREAD;
+    }
+
+    for (int i = 0; i < nthreads; i++){
+        ranges[i].data = map.data;
+        ranges[i].start = map.len / nthreads * i;
+        ranges[i].end = (i == nthreads - 1) ? map.len : map.len / nthreads * (i + 1);
+    }
+    //the first range runs on this thread
+    for (started = 1; started < nthreads; started++){
+        if (pthread_create(&ranges[started].tid, NULL, count_range_main, &ranges[started]) != 0){
+            break;
+        }
+    }
+    count_range_main(&ranges[0]);
+    for (int i = 1; i < started; i++){
+        pthread_join(ranges[i].tid, NULL);
+    }
+    //ranges that got no thread are counted here
+    for (int i = started; i < nthreads; i++){
+        count_range_main(&ranges[i]);
+    }
+
+    for (int i = 0; i < nthreads; i++){
+        words += ranges[i].words;
+    }
+    free(ranges);
+    unmap_file(&map);
+    return words;
+}
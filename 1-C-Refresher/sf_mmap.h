@@ -0,0 +1,34 @@
+#ifndef __SF_MMAP_H__
+    #define __SF_MMAP_H__
+
+#include <stddef.h>
+
+//Memory mapped files.  -c -j N file maps the file and counts the words of
+//N equal byte ranges on N threads.  A thread whose range starts inside a
+//word looks at the byte before its range, so a word cut by a range
+//boundary is counted once, by the range it starts in, and the total
+//matches count_words() exactly.
+//
+//-rs reverses a mapped file by walking it backwards, see reverse_fd().
+#define MMAP_MAX_THREADS    256
+
+#define MMAP_ERR_OPEN   -1
+#define MMAP_ERR_MAP    -2
+#define MMAP_ERR_THREAD -3
+#define MMAP_ERR_WRITE  -4
+
+//a read only mapping of a whole file, see map_file()
+typedef struct file_map {
+    const char *data;
+    size_t      len;
+    int         heap;       //data was read into the heap, not mapped
+} file_map_t;
+
+//prototypes for sf_mmap.c
+int map_fd(int, file_map_t *);
+int map_file(const char *, file_map_t *);
+void unmap_file(file_map_t *);
+long parallel_count_words(const char *, int);
+int reverse_fd(int);
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "sf_out.h"
+
+static char out_buf[OUT_BUF_SZ];
+static size_t out_len;
+static int out_err;         //a write failed, later output is dropped
+
+//two digits per entry, so out_long() divides by 100 once per pair
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+//writes the iov entries to stdout, resuming after short writes
+static void write_iov(struct iovec *iov, int cnt){
+    while (cnt > 0 && !out_err){
+        ssize_t w = writev(STDOUT_FILENO, iov, cnt);
+
+        if (w < 0){
+            out_err = 1;
+            return;
+        }
+        while (cnt > 0 && (size_t)w >= iov->iov_len){
+            w -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0){
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+}
+
+int out_flush(void){
+    struct iovec iov = {out_buf, out_len};
+
+    write_iov(&iov, 1);
+    out_len = 0;
+    return out_err ? OUT_ERR_WRITE : 0;
+}
+
+static void out_exit(void){
+    out_flush();
+}
+
+//writes out what is left at exit, error messages do not rely on this,
+//see out_error()
+__attribute__((constructor))
+static void out_init(void){
+    atexit(out_exit);
+}
+
+//printf()s an error message behind everything written so far
+void out_error(const char *fmt, ...){
+    va_list ap;
+
+    out_flush();
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    fflush(stdout);
+}
+
+void out_bytes(const char *p, size_t n){
+    if (n >= OUT_DIRECT_SZ){
+        struct iovec iov[2] = {{out_buf, out_len}, {(char *)p, n}};
+
+        write_iov(iov, 2);
+        out_len = 0;
+        return;
+    }
+    if (out_len + n > OUT_BUF_SZ){
+        out_flush();
+    }
+    memcpy(out_buf + out_len, p, n);
+    out_len += n;
+}
+
+void out_str(const char *s){
+    out_bytes(s, strlen(s));
+}
+
+void out_char(char c){
+    if (out_len == OUT_BUF_SZ){
+        out_flush();
+    }
+    out_buf[out_len++] = c;
+}
+
+//formats v in decimal from the end of a small buffer, two digits a step
+void out_long(long v){
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    unsigned long u = (v < 0) ? -(unsigned long)v : (unsigned long)v;
+
+    while (u >= 100){
+        p -= 2;
+        memcpy(p, digit_pairs + (u % 100) * 2, 2);
+        u /= 100;
+    }
+    if (u >= 10){
+        p -= 2;
+        memcpy(p, digit_pairs + u * 2, 2);
+    } else {
+        *--p = (char)('0' + u);
+    }
+    if (v < 0){
+        *--p = '-';
+    }
+    out_bytes(p, tmp + sizeof(tmp) - p);
+}
@@ -0,0 +1,26 @@
+#ifndef __SF_OUT_H__
+    #define __SF_OUT_H__
+
+#include <stddef.h>
+
+//Buffered output.  Everything stringfun prints to stdout, other than
+//usage(), goes through one OUT_BUF_SZ buffer that is written with write()
+//when it fills.  A piece at least OUT_DIRECT_SZ long is not copied, it
+//goes out together with the buffer in one writev().  Error messages go
+//through out_error(), which flushes the buffer before it prints and
+//flushes stdio after, so an error comes after the output before it
+//whether stdout is a terminal, a pipe or a file.
+#define OUT_BUF_SZ      (64*1024)
+#define OUT_DIRECT_SZ   (OUT_BUF_SZ / 4)
+
+#define OUT_ERR_WRITE   -1
+
+//prototypes for sf_out.c
+void out_bytes(const char *, size_t);
+void out_str(const char *);
+void out_char(char);
+void out_long(long);
+int  out_flush(void);
+void out_error(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
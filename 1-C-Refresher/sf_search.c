@@ -0,0 +1,202 @@
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+#include "sf_simd.h"
+#include "sf_stream.h"
+#include "sf_out.h"
+#include "sf_search.h"
+
+//the most common bytes of English text and code, most common first.  A
+//byte not listed is taken to be rarer than all of them.
+static const char common_bytes[] =
+    " etaoinsrhldcumfpgwybvkxjqzETAOINSRHLDCUMFPGWYBVKXJQZ"
+    "\n.,-_'\"()/:;=0123456789\t";
+
+static size_t byte_rank(unsigned char c){
+    const char *p = (c == 0) ? NULL : strchr(common_bytes, c);
+    return (p == NULL) ? sizeof(common_bytes) : (size_t)(p - common_bytes);
+}
+
+static long find_byte(const search_t *s, const char *hay, size_t n){
+    const char *p = memchr(hay, s->pat[0], n);
+    return (p == NULL) ? -1 : p - hay;
+}
+
+//memchr() for the rare byte, then a full compare around each hit
+static long find_rare(const search_t *s, const char *hay, size_t n){
+    const char *end = hay + n - s->len + s->rare + 1;   //last rare position + 1
+    const char *p = hay + s->rare;
+
+    if (n < s->len){
+        return -1;
+    }
+    while ((p = memchr(p, s->pat[s->rare], end - p)) != NULL){
+        const char *start = p - s->rare;
+
+        if (memcmp(start, s->pat, s->len) == 0){
+            return start - hay;
+        }
+        p++;
+    }
+    return -1;
+}
+
+#ifdef SIMD_X86
+//candidate starts among the 32 positions at p: pattern byte 0 at p and
+//byte off further on both match
+__attribute__((target("avx2")))
+static inline unsigned pair_mask(const char *p, size_t off, __m256i b0, __m256i b1){
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + off));
+    return (unsigned)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(a, b0), _mm256_cmpeq_epi8(b, b1)));
+}
+
+//tests 64 starting positions per step for the first byte of the pattern
+//and a second one, its rarest byte, or its last if the first is rarest
+__attribute__((target("avx2")))
+static long find_avx2(const search_t *s, const char *hay, size_t n){
+    size_t off = (s->rare != 0) ? s->rare : s->len - 1;
+    const __m256i b0 = _mm256_set1_epi8(s->pat[0]);
+    const __m256i b1 = _mm256_set1_epi8(s->pat[off]);
+    size_t i = 0;
+    long rest;
+
+    if (n < s->len){
+        return -1;
+    }
+    for (; i + s->len - 1 + 64 <= n; i += 64){
+        uint64_t m = pair_mask(hay + i, off, b0, b1)
+                   | (uint64_t)pair_mask(hay + i + 32, off, b0, b1) << 32;
+
+        while (m != 0){
+            size_t pos = i + __builtin_ctzll(m);
+
+            if (memcmp(hay + pos, s->pat, s->len) == 0){
+                return (long)pos;
+            }
+            m &= m - 1;
+        }
+    }
+    rest = find_rare(s, hay + i, n - i);
+    return (rest < 0) ? -1 : (long)i + rest;
+}
+#endif
+
+//prepares the len byte pattern pat, len at least 1.  pat is not copied.
+void search_init(search_t *s, const char *pat, size_t len){
+    s->pat = pat;
+    s->len = len;
+    s->rare = 0;
+    for (size_t i = 1; i < len; i++){
+        if (byte_rank(pat[i]) > byte_rank(pat[s->rare])){
+            s->rare = i;
+        }
+    }
+
+    s->find = (len == 1) ? find_byte : find_rare;
+#ifdef SIMD_X86
+    if (len > 1 && simd_has_avx2()){
+        s->find = find_avx2;
+    }
+#endif
+}
+
+//returns the offset of the first match in the n bytes of hay, or -1
+long search_next(const search_t *s, const char *hay, size_t n){
+    return s->find(s, hay, n);
+}
+
+//appends k bytes of p to dst at *w, as many as fit in cap
+static void put(char *dst, size_t cap, size_t *w, const char *p, size_t k){
+    if (k > cap - *w){
+        k = cap - *w;
+    }
+    memcpy(dst + *w, p, k);
+    *w += k;
+}
+
+//replace_bytes
+//  Copies the n bytes of src to dst with every match of s replaced by the
+//  rlen bytes of repl, left to right, without looking for matches in what
+//  was put in.  Output past cap bytes is cut off.  dst and src must not
+//  overlap.  *count is set to the number of replacements.
+//
+//  returns the number of bytes written to dst
+long replace_bytes(const search_t *s, char *dst, size_t cap, const char *src, size_t n,
+                   const char *repl, size_t rlen, long *count){
+    size_t w = 0;
+    size_t p = 0;
+    long q;
+
+    *count = 0;
+    while (p < n && (q = search_next(s, src + p, n - p)) >= 0){
+        put(dst, cap, &w, src + p, q);
+        put(dst, cap, &w, repl, rlen);
+        (*count)++;
+        p += q + s->len;
+    }
+    put(dst, cap, &w, src + p, n - p);
+    return (long)w;
+}
+
+//stream_replace() state, win holds the bytes held back from the previous
+//chunk followed by the current chunk
+typedef struct replace_state {
+    search_t    s;
+    const char *repl;
+    size_t      rlen;
+    char       *win;
+    size_t      carry;
+} replace_state_t;
+
+static int replace_chunk(const char *chunk, int n, void *ctx){
+    replace_state_t *st = ctx;
+    size_t len = st->carry + n;
+    size_t p = 0;
+    size_t keep;
+    long q;
+
+    memcpy(st->win + st->carry, chunk, n);
+    while (len - p >= st->s.len && (q = search_next(&st->s, st->win + p, len - p)) >= 0){
+        out_bytes(st->win + p, q);
+        out_bytes(st->repl, st->rlen);
+        p += q + st->s.len;
+    }
+    //a match may still start in the last len - 1 bytes
+    keep = (len - p < st->s.len - 1) ? len - p : st->s.len - 1;
+    out_bytes(st->win + p, len - p - keep);
+    memmove(st->win, st->win + len - keep, keep);
+    st->carry = keep;
+    return 0;
+}
+
+//stream_replace
+//  Writes fd to the output with every find replaced by repl, see
+//  sf_search.h.  find must not be empty.
+//
+//  returns 0, SEARCH_ERR_MEM, or a stream_chunks() error
+int stream_replace(int fd, const char *find, const char *repl){
+    replace_state_t st;
+    int rc;
+
+    search_init(&st.s, find, strlen(find));
+    st.repl = repl;
+    st.rlen = strlen(repl);
+    st.carry = 0;
+    st.win = malloc(STREAM_CHUNK_SZ + st.s.len - 1);
+    if (st.win == NULL){
+        return SEARCH_ERR_MEM;
+    }
+    rc = stream_chunks(fd, replace_chunk, &st);
+    if (rc == 0){
+        out_bytes(st.win, st.carry);
+    }
+    free(st.win);
+    return rc;
+}
@@ -0,0 +1,37 @@
+#ifndef __SF_SEARCH_H__
+    #define __SF_SEARCH_H__
+
+#include <stddef.h>
+
+//Substring search.  search_init() prepares a pattern once and picks the
+//kernel for it:
+//
+//  - a 1 byte pattern is a memchr()
+//  - with AVX2, 64 positions at a time are tested for the first byte of
+//    the pattern and its rarest byte (its last, if the first is rarest)
+//    together, and only positions where both match are compared in full
+//  - otherwise memchr() looks for the pattern's rarest byte (by a fixed
+//    table of common text bytes) and each hit is compared in full
+//
+//-x "string" find replace replaces every find in the normalized string,
+//see replace_string() in stringfun.c.  -xs find replace [file] does the
+//same on a stream, raw and unnormalized, like sed s/find/replace/g on
+//bytes: the last len - 1 bytes of a chunk are held back until the next
+//chunk shows whether a match starts in them.
+typedef struct search {
+    const char *pat;
+    size_t      len;
+    size_t      rare;       //index of the rarest byte of pat
+    long      (*find)(const struct search *, const char *, size_t);
+} search_t;
+
+#define SEARCH_ERR_MEM  -4  //after the stream_chunks() errors
+
+//prototypes for sf_search.c
+void search_init(search_t *, const char *, size_t);
+long search_next(const search_t *, const char *, size_t);
+long replace_bytes(const search_t *, char *, size_t, const char *, size_t,
+                   const char *, size_t, long *);
+int  stream_replace(int, const char *, const char *);
+
+#endif
@@ -0,0 +1,268 @@
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+#include "sf_simd.h"
+
+//room normalize() needs for one block: the block and the space before it
+#define NORM_BLOCK_OUT  (SIMD_BLOCK + 1)
+
+static int is_ws(unsigned char c){
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+//whitespace mask of the first n (at most SIMD_BLOCK) bytes of p
+static uint64_t mask_scalar(const char *p, size_t n){
+    uint64_t m = 0;
+
+    for (size_t i = 0; i < n; i++){
+        m |= (uint64_t)is_ws(p[i]) << i;
+    }
+    return m;
+}
+
+#ifdef SIMD_X86
+//whitespace bytes of one 16 byte vector as 0xff
+__attribute__((target("sse2")))
+static __m128i ws_sse2(__m128i v){
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t);
+    return _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+__attribute__((target("sse2")))
+static uint64_t mask_sse2(const char *p){
+    uint64_t m = 0;
+
+    for (int i = 0; i < SIMD_BLOCK; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws_sse2(v)) << i;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static uint64_t mask_avx2(const char *p){
+    uint64_t m = 0;
+
+    for (int i = 0; i < SIMD_BLOCK; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8('\r' - '\t')), t);
+        __m256i ws = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        m |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+    }
+    return m;
+}
+#endif
+
+static uint64_t mask_block_scalar(const char *p){
+    return mask_scalar(p, SIMD_BLOCK);
+}
+
+//writes the n bytes of src to dst in reverse order, for n below the
+//vector width and for CPUs without one
+static void rev_scalar(char *dst, const char *src, size_t n){
+    for (size_t i = 0; i < n; i++){
+        dst[i] = src[n - 1 - i];
+    }
+}
+
+#ifdef SIMD_X86
+__attribute__((target("ssse3")))
+static void rev_ssse3(char *dst, const char *src, size_t n){
+    const __m128i idx = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + n - 16 - i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, idx));
+    }
+    rev_scalar(dst + i, src, n - i);
+}
+
+//vpshufb reverses each 128 bit lane, then the two lanes trade places
+__attribute__((target("avx2")))
+static void rev_avx2(char *dst, const char *src, size_t n){
+    const __m256i idx = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                         15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + n - 32 - i));
+        v = _mm256_shuffle_epi8(v, idx);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute2x128_si256(v, v, 1));
+    }
+    rev_scalar(dst + i, src, n - i);
+}
+#endif
+
+//kernels, set to the best ones for the CPU before main() runs, so threads
+//never race to pick them
+static uint64_t (*mask_block)(const char *) = mask_block_scalar;
+static void (*rev_block)(char *, const char *, size_t) = rev_scalar;
+static int use_avx2;
+
+__attribute__((constructor))
+static void simd_resolve(void){
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (getenv("STRINGFUN_SCALAR") == NULL){
+        if (__builtin_cpu_supports("avx2")){
+            mask_block = mask_avx2;
+            rev_block = rev_avx2;
+            use_avx2 = 1;
+        } else if (__builtin_cpu_supports("sse2")){
+            mask_block = mask_sse2;
+            if (__builtin_cpu_supports("ssse3")){
+                rev_block = rev_ssse3;
+            }
+        }
+    }
+#endif
+}
+
+//1 if the AVX2 kernels were picked, for other modules with AVX2 code
+int simd_has_avx2(void){
+    return use_avx2;
+}
+
+//whitespace mask of the first n bytes of p, n at most SIMD_BLOCK.  Bits
+//past n are 0.
+uint64_t ws_mask(const char *p, size_t n){
+    return (n == SIMD_BLOCK) ? mask_block(p) : mask_scalar(p, n);
+}
+
+//normalizes the n bytes of block p with whitespace mask ws into out,
+//returns the end of what was written
+static char *norm_block(char *out, const char *p, uint64_t ws, int n, int *state){
+    int pos = 0;
+
+    while (pos < n){
+        uint64_t rest = ws >> pos;
+        int run;
+
+        if (rest & 1){
+            //a whitespace run, ~rest has a 0 bit at least at n - pos
+            run = __builtin_ctzll(~rest);
+            if (*state == NORM_WORD){
+                *state = NORM_SPACE;
+            }
+        } else {
+            run = (rest == 0) ? n - pos : __builtin_ctzll(rest);
+            if (run > n - pos){
+                run = n - pos;
+            }
+            if (*state == NORM_SPACE){
+                *out++ = ' ';
+            }
+            memcpy(out, p + pos, run);
+            out += run;
+            *state = NORM_WORD;
+        }
+        pos += run;
+    }
+    return out;
+}
+
+//normalize
+//  Collapses every whitespace run of src to one space and trims the ends,
+//  in one pass.  state carries a run or a word over from the previous
+//  piece of the same input, start it at NORM_START.  Trailing whitespace is
+//  held back in the state and never written.
+//
+//  returns the number of bytes written to dst, or -1 if more than cap
+//  bytes would be needed (dst is then partly written)
+long normalize(char *dst, size_t cap, const char *src, size_t len, int *state){
+    char stage[NORM_BLOCK_OUT];
+    size_t written = 0;
+
+    for (size_t i = 0; i < len; i += SIMD_BLOCK){
+        int n = (len - i < SIMD_BLOCK) ? (int)(len - i) : SIMD_BLOCK;
+        uint64_t ws = ws_mask(src + i, n);
+        size_t k;
+
+        //blocks with no whitespace, or only whitespace, are the common
+        //case in long words and indentation
+        if (ws == 0 && n == SIMD_BLOCK && *state != NORM_SPACE && cap - written >= SIMD_BLOCK){
+            memcpy(dst + written, src + i, SIMD_BLOCK);
+            written += SIMD_BLOCK;
+            *state = NORM_WORD;
+            continue;
+        }
+        if (n == SIMD_BLOCK && ws == UINT64_MAX){
+            if (*state == NORM_WORD){
+                *state = NORM_SPACE;
+            }
+            continue;
+        }
+
+        if (cap - written >= NORM_BLOCK_OUT){
+            written = norm_block(dst + written, src + i, ws, n, state) - dst;
+            continue;
+        }
+        //close to the end of dst, go through the stage to stay in bounds
+        k = norm_block(stage, src + i, ws, n, state) - stage;
+        if (k > cap - written){
+            return -1;
+        }
+        memcpy(dst + written, stage, k);
+        written += k;
+    }
+    return (long)written;
+}
+
+//count_words_len
+//  Counts the words (runs of non whitespace) of buf.  A word starts at
+//  every non whitespace byte whose previous byte is whitespace, so per
+//  block the starts are ~ws & (ws << 1 | carry), where carry is the
+//  whitespace bit of the last byte of the previous block.  *in_word carries
+//  that across calls on consecutive pieces of the same input, start it at
+//  0.  A word cut between two pieces is counted once, in the first.
+//
+//  returns the number of words that start in buf
+long count_words_len(const char *buf, size_t len, int *in_word){
+    uint64_t carry = (*in_word == 0);
+    long words = 0;
+
+    for (size_t i = 0; i < len; i += SIMD_BLOCK){
+        int n = (len - i < SIMD_BLOCK) ? (int)(len - i) : SIMD_BLOCK;
+        uint64_t valid = (n == SIMD_BLOCK) ? UINT64_MAX : ((uint64_t)1 << n) - 1;
+        uint64_t ws = ws_mask(buf + i, n);
+
+        words += __builtin_popcountll(~ws & ((ws << 1) | carry) & valid);
+        carry = (ws >> (n - 1)) & 1;
+    }
+    if (len > 0){
+        *in_word = (carry == 0);
+    }
+    return words;
+}
+
+//writes the n bytes of src to dst in reverse order, src and dst must not
+//overlap
+void reverse_bytes(char *dst, const char *src, size_t n){
+    rev_block(dst, src, n);
+}
+
+//reverses buf in place, trading reversed 32 byte pieces between the two
+//ends until the middle is short enough to reverse through a copy
+void reverse_in_place(char *buf, size_t n){
+    char head[32], tail[32], mid[64];
+    size_t lo = 0, hi = n;
+
+    while (hi - lo >= sizeof(mid)){
+        reverse_bytes(head, buf + lo, sizeof(head));
+        reverse_bytes(tail, buf + hi - sizeof(tail), sizeof(tail));
+        memcpy(buf + lo, tail, sizeof(tail));
+        memcpy(buf + hi - sizeof(head), head, sizeof(head));
+        lo += sizeof(head);
+        hi -= sizeof(tail);
+    }
+    reverse_bytes(mid, buf + lo, hi - lo);
+    memcpy(buf + lo, mid, hi - lo);
+}
@@ -0,0 +1,29 @@
+#ifndef __SF_SIMD_H__
+    #define __SF_SIMD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Vector kernels.  Text is classified SIMD_BLOCK bytes at a time into a
+//whitespace bitmask (bit i set if byte i is whitespace, as isspace() in the
+//C locale: ' ' and '\t' through '\r').  The mask is built with AVX2 or
+//SSE2 when the CPU has them, picked at run time, and with a scalar loop
+//otherwise (or if STRINGFUN_SCALAR is set in the environment).  Byte
+//reversal uses AVX2 or SSSE3 shuffles the same way.
+#define SIMD_BLOCK      64
+
+//normalize() state, carried between calls on consecutive pieces of input
+#define NORM_START      0   //nothing written yet, leading whitespace is dropped
+#define NORM_WORD       1   //inside a word
+#define NORM_SPACE      2   //whitespace after a word, written as one space
+                            //only if another word follows
+
+//prototypes for sf_simd.c
+int simd_has_avx2(void);
+uint64_t ws_mask(const char *, size_t);
+long normalize(char *, size_t, const char *, size_t, int *);
+long count_words_len(const char *, size_t, int *);
+void reverse_bytes(char *, const char *, size_t);
+void reverse_in_place(char *, size_t);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sf_simd.h"
+#include "sf_stream.h"
+#include "sf_out.h"
+
+//opens path for reading, stdin if path is NULL or "-"
+int stream_open(const char *path){
+    if (path == NULL || strcmp(path, "-") == 0){
+        return STDIN_FILENO;
+    }
+    int fd = open(path, O_RDONLY);
+    return (fd < 0) ? STREAM_ERR_OPEN : fd;
+}
+
+//reads fd to the end one chunk at a time, the chunk buffer is the only
+//memory the stream needs
+int stream_chunks(int fd, chunk_fn fn, void *ctx){
+    char *chunk = malloc(STREAM_CHUNK_SZ);
+    ssize_t n;
+    int rc = 0;
+
+    if (chunk == NULL){
+        return STREAM_ERR_MEM;
+    }
+    while (rc == 0 && (n = read(fd, chunk, STREAM_CHUNK_SZ)) != 0){
+        if (n < 0){
+            rc = STREAM_ERR_READ;
+            break;
+        }
+        rc = fn(chunk, (int)n, ctx);
+    }
+    free(chunk);
+    return rc;
+}
+
+//word state carried from one chunk to the next
+typedef struct word_state {
+    long words;         //words started so far
+    long word_len;      //length of the current word so far
+    int  in_word;       //the last byte seen was part of a word
+} word_state_t;
+
+static int count_chunk(const char *chunk, int n, void *ctx){
+    word_state_t *st = ctx;
+
+    st->words += count_words_len(chunk, n, &st->in_word);
+    return 0;
+}
+
+int stream_count_words(int fd){
+    word_state_t st = {0};
+    int rc = stream_chunks(fd, count_chunk, &st);
+
+    if (rc < 0){
+        return rc;
+    }
+    out_str("Word Count: ");
+    out_long(st.words);
+    out_char('\n');
+    return 0;
+}
+
+//prints each word as its bytes arrive, so a word can be longer than a chunk
+static int print_chunk(const char *chunk, int n, void *ctx){
+    word_state_t *st = ctx;
+    int start = 0;
+
+    for (int i = 0; i < n; i++){
+        if (isspace((unsigned char)chunk[i])){
+            if (st->in_word){
+                out_bytes(chunk + start, i - start);
+                out_str(" (");
+                out_long(st->word_len);
+                out_str(")\n");
+                st->in_word = 0;
+            }
+        } else {
+            if (!st->in_word){
+                out_long(++st->words);
+                out_str(". ");
+                st->word_len = 0;
+                start = i;
+            }
+            st->in_word = 1;
+            st->word_len++;
+        }
+    }
+    //the rest of a word cut by the chunk boundary
+    if (st->in_word){
+        out_bytes(chunk + start, n - start);
+    }
+    return 0;
+}
+
+int stream_word_print(int fd){
+    word_state_t st = {0};
+
+    out_str("Word Print\n");
+    out_str("----------\n");
+    int rc = stream_chunks(fd, print_chunk, &st);
+    if (rc < 0){
+        return rc;
+    }
+    if (st.in_word){
+        out_str(" (");
+        out_long(st.word_len);
+        out_str(")\n");
+    }
+    out_str("Number of words returned: ");
+    out_long(st.words);
+    out_char('\n');
+    return 0;
+}
+
+//normalize() state and the buffer the chunks are normalized into
+typedef struct norm_state {
+    int   state;
+    char *out;
+} norm_state_t;
+
+static int normalize_chunk(const char *chunk, int n, void *ctx){
+    norm_state_t *st = ctx;
+    long len = normalize(st->out, STREAM_CHUNK_SZ + 1, chunk, n, &st->state);
+
+    out_bytes(st->out, len);
+    return 0;
+}
+
+int stream_normalize(int fd){
+    norm_state_t st = {NORM_START, malloc(STREAM_CHUNK_SZ + 1)};
+    int rc;
+
+    if (st.out == NULL){
+        return STREAM_ERR_MEM;
+    }
+    rc = stream_chunks(fd, normalize_chunk, &st);
+    free(st.out);
+    if (rc < 0){
+        return rc;
+    }
+    out_char('\n');
+    return 0;
+}
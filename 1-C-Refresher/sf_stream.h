@@ -0,0 +1,33 @@
+#ifndef __SF_STREAM_H__
+    #define __SF_STREAM_H__
+
+//Streaming mode.  Adding an 's' to the option (-cs, -ws, -ns) takes the
+//input from a file, or stdin if none is given, instead of the command
+//line.  The input is read STREAM_CHUNK_SZ bytes at a time and the state
+//of a word cut by a chunk boundary is carried over to the next chunk, so
+//inputs of any size run in constant memory.
+//
+//  -cs [file]   Word Count: N
+//  -ws [file]   the -w listing, words of any length
+//  -ns [file]   the input with whitespace runs collapsed to one space and
+//               the ends trimmed, as setup_buff() does
+//  -rs [file]   the -ns output reversed, see reverse_fd() in sf_mmap.c
+#define STREAM_CHUNK_SZ (256*1024)
+
+#define STREAM_ERR_OPEN -1
+#define STREAM_ERR_READ -2
+#define STREAM_ERR_MEM  -3
+
+//called by stream_chunks() for every chunk of the input, in order, with
+//the chunk, its length and the caller's context.  A negative return
+//stops the stream and is returned from stream_chunks().
+typedef int (*chunk_fn)(const char *, int, void *);
+
+//prototypes for sf_stream.c
+int stream_open(const char *);
+int stream_chunks(int, chunk_fn, void *);
+int stream_count_words(int);
+int stream_word_print(int);
+int stream_normalize(int);
+
+#endif
@@ -2,6 +2,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>
+
+#include "sf_simd.h"
+#include "sf_stream.h"
+#include "sf_mmap.h"
+#include "sf_out.h"
+#include "sf_freq.h"
+#include "sf_search.h"
 
 
 #define BUFFER_SZ 50
@@ -16,156 +24,101 @@ int  count_words(char *, int, int);
 int reverse_string(char *, int, int);
 int word_print(char *, int, int);
 //add additional prototypes here
+int replace_string(char *, int, int, char *, char *);
+int fused_ops(char *, int, int, const char *);
+int run_stream(char *, char, int, char **);
+int run_freq(char *, int, char **);
+int run_batch(char *, char *, int, char **);
 
 
+//normalizes user_str into buff in one pass, see normalize() in sf_simd.c,
+//and pads the rest of buff with dots.  Returns the normalized length, or
+//-1 if it does not fit in len bytes.
 int setup_buff(char *buff, char *user_str, int len){
-    char *user_ptr = user_str;      // Pointer to iterate through the user string
-    int processed_str_len = 0;      // Length of the processed string
-    int whitespace = 0;             // To track consecutive whitespace characters
-
-    // Step 1: Calculate the length of the processed string
-    while (*user_ptr != '\0') {
-        if (isspace(*user_ptr)) {
-            if (whitespace == 0) {
-                processed_str_len++;  // Count a single space
-                whitespace = 1;
-            }
-        } else {
-            processed_str_len++;      // Count non-space characters
-            whitespace = 0;
-        }
-        user_ptr++;
-    }
+    int state = NORM_START;
+    long str_len = normalize(buff, len, user_str, strlen(user_str), &state);
 
-    // Step 2: Check if the processed string exceeds the buffer length
-    if (processed_str_len > len) {
+    if (str_len < 0) {
         return -1; // Reject the string
     }
-
-    // Step 3: Reset pointers and copy to the buffer
-    user_ptr = user_str;
-    char *buff_ptr = buff;          // Pointer to write to the buffer
-    int buffer_count = 0;
-    whitespace = 0;
-
-    // Trim leading spaces
-    while (*user_ptr != '\0' && isspace(*user_ptr)) {
-        user_ptr++;
-    }
-
-    // Copy characters into the buffer
-    while (*user_ptr != '\0') {
-        if (isspace(*user_ptr)) {
-            if (whitespace == 0) {
-                *buff_ptr = ' ';
-                buff_ptr++;
-                buffer_count++;
-                whitespace = 1;
-            }
-        } else {
-            *buff_ptr = *user_ptr;
-            buff_ptr++;
-            buffer_count++;
-            whitespace = 0;
-        }
-        user_ptr++;
-    }
-
-    // Remove trailing space if present
-    if (buffer_count > 0 && *(buff_ptr - 1) == ' ') {
-        buff_ptr--;
-        buffer_count--;
-    }
-
-    // Fill remaining buffer space with dots
-    while (buffer_count < len) {
-        *buff_ptr = '.';
-        buff_ptr++;
-        buffer_count++;
-    }
-
-    return processed_str_len;
+    memset(buff + str_len, '.', len - str_len);
+    return (int)str_len;
 }
 
 void print_buff(char *buff, int len){
-    printf("Buffer:  ");
-    for (int i=0; i<len; i++){
-        putchar(*(buff+i));
-    }
-    putchar('\n');
+    out_str("Buffer:  ");
+    out_bytes(buff, len);
+    out_char('\n');
 }
 
 void usage(char *exename){
     printf("usage: %s [-h|c|r|w|x] \"string\" [other args]\n", exename);
+    printf("       %s -[crw]... \"string\"    (several options in one pass)\n", exename);
+    printf("       %s [-cs|ws|ns|rs] [file]  (stream a file or stdin)\n", exename);
+    printf("       %s -xs find replace [file]\n", exename);
+    printf("       %s -c -j N file           (count on N threads)\n", exename);
+    printf("       %s -f [topK] [file]       (most frequent words)\n", exename);
+    printf("       %s -L[c|r|w|x|crw...] [find replace] [file]  (every line of a file or stdin)\n", exename);
 
 }
 
 int count_words(char *buff, int len, int str_len){
-    //YOU MUST IMPLEMENT
-    int word_count = 0;
-    int same_word = 0; // To track if we are inside a word or not (1 = inside a word, 0 = outside)
+    int in_word = 0;
+    int word_count;
 
-    for (int i = 0; i < str_len; i++) {
-        if (isspace(buff[i])) {
-            same_word = 0;
-        } else {
-            if (same_word == 0) {
-                word_count++;
-            } 
-            same_word = 1;
-        }
+    if (str_len > len){
+        return -1;
     }
+    //bitmask kernel, see count_words_len() in sf_simd.c
+    word_count = (int)count_words_len(buff, str_len, &in_word);
 
-    printf("Word Count: %d\n", word_count);
+    out_str("Word Count: ");
+    out_long(word_count);
+    out_char('\n');
     return word_count;
 }
 
 int reverse_string(char *buff, int len, int str_len) {
-    int start = 0;
-    int end = str_len - 1;
-
-    // Reverse the string in place
-    while (start < end) {
-        // Swap characters at the start and end
-        char temp = buff[start];
-        buff[start] = buff[end];
-        buff[end] = temp;
-
-        start++;
-        end--;
+    if (str_len > len){
+        return -1;
     }
+    //shuffle kernel, see reverse_in_place() in sf_simd.c
+    reverse_in_place(buff, str_len);
 
-     // Print reversed string without dots
-    printf("Reversed String: ");
-    for (int i = 0; i < str_len; i++) {
-        if (buff[i] == '.') {
-            break;  // Stop printing when we encounter a dot
-        }
-        putchar(buff[i]);  // Print each character
-    }
-    putchar('\n');  // Print a newline after the reversed string
+    // Print exactly the reversed string, a '.' in the input is text too
+    out_str("Reversed String: ");
+    out_bytes(buff, str_len);
+    out_char('\n');  // Print a newline after the reversed string
 
     return 0;
 }
 
+//prints one line of the -w listing, "N. word (len)"
+static void print_word(int num, const char *word, int word_length){
+    out_long(num);
+    out_str(". ");
+    out_bytes(word, word_length);
+    out_str(" (");
+    out_long(word_length);
+    out_str(")\n");
+}
+
 int word_print(char *buff, int len, int str_len) {
     int word_count = 0;
     int same_word = 0;  // Flag to track if we are inside a word
     int start_index = 0;  // To mark the start of a word
-    
-    printf("Word Print\n");
-    printf("----------\n");
+
+    if (str_len > len){
+        return -1;
+    }
+    out_str("Word Print\n");
+    out_str("----------\n");
 
     // Iterate over the buffer up to str_len (the length of the user string)
     for (int i = 0; i < str_len; i++) {
         if (isspace(buff[i])) {  // If the character is a space, it's a delimiter
             if (same_word) {  // Word ends
-                int word_length = i - start_index;
-                printf("%d. ", ++word_count);  // Word number
-                for (int j = start_index; j < i; j++) {
-                    putchar(buff[j]);  // Print the word
-                }
-                printf(" (%d)\n", word_length);  // Print the word length
+                print_word(++word_count, buff + start_index, i - start_index);
                 same_word = 0;  // Reset flag after a word is printed
             }
         } else {
@@ -178,20 +131,330 @@ int word_print(char *buff, int len, int str_len) {
 
     // Handle the last word (if there is one) after the loop
     if (same_word) {
-        int word_length = str_len - start_index;
-        printf("%d. ", ++word_count);
-        for (int i = start_index; i < str_len; i++) {
-            putchar(buff[i]);  // Print the last word
-        }
-        printf(" (%d)\n", word_length);  // Print the word length
+        print_word(++word_count, buff + start_index, str_len - start_index);
     }
-    printf("Number of words returned: %d\n", word_count);
+    out_str("Number of words returned: ");
+    out_long(word_count);
+    out_char('\n');
 
     return 0;
 }
 
 //ADD OTHER HELPER FUNCTIONS HERE FOR OTHER REQUIRED PROGRAM OPTIONS
 
+//replaces every find in the first str_len bytes of buff with repl, cuts
+//the result off at len bytes and pads it with dots, see sf_search.h.
+//Returns the number of replacements, -1 if the arguments are bad, or -2
+//if find does not occur.
+int replace_string(char *buff, int len, int str_len, char *find, char *repl){
+    char src[BUFFER_SZ];
+    search_t s;
+    long count;
+    long new_len;
+
+    if (str_len > len || len > BUFFER_SZ || *find == '\0'){
+        return -1;
+    }
+    memcpy(src, buff, str_len);
+    search_init(&s, find, strlen(find));
+    new_len = replace_bytes(&s, buff, len, src, str_len, repl, strlen(repl), &count);
+    if (count == 0){
+        return -2;
+    }
+    memset(buff + new_len, '.', len - new_len);
+    return (int)count;
+}
+
+//runs a streaming option (-cs, -ws, -ns, -rs, -xs) over a file, or stdin
+//if none is given, and returns the exit code.  args are what follows the
+//option, -xs takes find and replace before the file.
+int run_stream(char *exename, char opt, int argc, char **args){
+    char *path;
+    int fd;
+    int rc;
+
+    if (opt == 'x' && argc >= 2 && *args[0] != '\0'){
+        args += 2;
+        argc -= 2;
+    } else if (opt != 'c' && opt != 'w' && opt != 'n' && opt != 'r'){
+        usage(exename);
+        return 1;
+    }
+    path = (argc > 0) ? args[0] : NULL;
+    fd = stream_open(path);
+    if (fd < 0){
+        out_error("Error opening %s\n", path);
+        return 2;
+    }
+
+    if (opt == 'c'){
+        rc = stream_count_words(fd);
+    } else if (opt == 'w'){
+        rc = stream_word_print(fd);
+    } else if (opt == 'r'){
+        //needs the whole input, mapped when it is a file, see sf_mmap.h
+        rc = reverse_fd(fd);
+    } else if (opt == 'x'){
+        rc = stream_replace(fd, args[-2], args[-1]);
+    } else {
+        rc = stream_normalize(fd);
+    }
+    if (rc == 0){
+        rc = out_flush();   //a full disk or closed pipe shows up here
+    }
+    if (fd != STDIN_FILENO){
+        close(fd);
+    }
+    if (rc < 0){
+        out_error("Error streaming input, rc = %d\n", rc);
+        return 2;
+    }
+    return 0;
+}
+
+//1 if ops is two or more of c, r and w, each at most once
+static int fused_valid(const char *ops){
+    size_t n = strlen(ops);
+
+    if (n < 2 || strspn(ops, "crw") != n){
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++){
+        if (strchr(ops + i + 1, ops[i]) != NULL){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//fused_ops
+//  Runs every option of ops (see fused_valid()) on one set up buffer, and
+//  prints their output, less the Buffer line, in the order given.  The
+//  words are found in one pass and give both the count and the listing.
+//  The reverse is made in one copy, so buff stays as set up and the
+//  caller prints it once after.
+//
+//  returns the word count, or -1 if str_len > len or len > BUFFER_SZ
+int fused_ops(char *buff, int len, int str_len, const char *ops){
+    int starts[BUFFER_SZ / 2 + 1];
+    int ends[BUFFER_SZ / 2 + 1];
+    char rev[BUFFER_SZ];
+    int words = 0;
+
+    if (str_len > len || len > BUFFER_SZ){
+        return -1;
+    }
+    for (int i = 0; i < str_len; i++){
+        if (isspace(buff[i])){
+            continue;
+        }
+        starts[words] = i;
+        while (i < str_len && !isspace(buff[i])){
+            i++;
+        }
+        ends[words++] = i;
+    }
+
+    for (; *ops != '\0'; ops++){
+        switch (*ops){
+            case 'c':
+                out_str("Word Count: ");
+                out_long(words);
+                out_char('\n');
+                break;
+            case 'r':
+                reverse_bytes(rev, buff, str_len);
+                out_str("Reversed String: ");
+                out_bytes(rev, str_len);
+                out_char('\n');
+                break;
+            case 'w':
+                out_str("Word Print\n");
+                out_str("----------\n");
+                for (int k = 0; k < words; k++){
+                    print_word(k + 1, buff + starts[k], ends[k] - starts[k]);
+                }
+                out_str("Number of words returned: ");
+                out_long(words);
+                out_char('\n');
+                break;
+        }
+    }
+    return words;
+}
+
+//runs -f [topK] [file], args are what follows -f.  A first argument of
+//only digits is topK, anything else is the file.
+int run_freq(char *exename, int argc, char **args){
+    long top_k = FREQ_TOP_DEFAULT;
+    char *path = NULL;
+    int fd;
+    int rc;
+
+    if (argc > 0 && args[0][0] != '\0' && strspn(args[0], "0123456789") == strlen(args[0])){
+        top_k = atol(args[0]);
+        args++;
+        argc--;
+    }
+    if (argc > 1 || top_k < 1){
+        usage(exename);
+        return 1;
+    }
+    if (argc == 1){
+        path = args[0];
+    }
+    fd = stream_open(path);
+    if (fd < 0){
+        out_error("Error opening %s\n", path);
+        return 2;
+    }
+
+    rc = word_freq(fd, top_k);
+    if (rc == 0){
+        rc = out_flush();
+    }
+    if (fd != STDIN_FILENO){
+        close(fd);
+    }
+    if (rc < 0){
+        out_error("Error counting word frequencies, rc = %d\n", rc);
+        return 2;
+    }
+    return 0;
+}
+
+//-L state.  A line is normalized into buff piece by piece as chunks
+//arrive, normalize() carries the state, so lines are never assembled and
+//nothing is allocated per line.
+typedef struct batch {
+    char *ops;          //one option, or several for fused_ops()
+    char *find;
+    char *repl;
+    char *buff;
+    int   str_len;      //normalized so far, -1 once the line does not fit
+    int   state;
+    int   in_line;      //part of a line without its newline was seen
+    int   failed;       //some line failed
+} batch_t;
+
+//runs op on the line in buff, with the output of a single invocation
+static void batch_line(batch_t *b){
+    int rc = 0;
+
+    if (b->str_len < 0){
+        out_str("Error setting up buffer, error = -1\n");
+        b->failed = 1;
+    } else {
+        memset(b->buff + b->str_len, '.', BUFFER_SZ - b->str_len);
+        switch ((b->ops[1] == '\0') ? b->ops[0] : 0){
+            case 'c':
+                count_words(b->buff, BUFFER_SZ, b->str_len);
+                break;
+            case 'r':
+                reverse_string(b->buff, BUFFER_SZ, b->str_len);
+                break;
+            case 'w':
+                word_print(b->buff, BUFFER_SZ, b->str_len);
+                break;
+            case 'x':
+                rc = replace_string(b->buff, BUFFER_SZ, b->str_len, b->find, b->repl);
+                break;
+            default:
+                fused_ops(b->buff, BUFFER_SZ, b->str_len, b->ops);
+                break;
+        }
+        if (rc < 0){
+            out_str("Error replacing string, rc = ");
+            out_long(rc);
+            out_char('\n');
+            b->failed = 1;
+        } else if (b->ops[0] == 'x'){
+            out_str("Buffer:  [");
+            out_bytes(b->buff, BUFFER_SZ);
+            out_str("]\n");
+        } else {
+            print_buff(b->buff, BUFFER_SZ);
+        }
+    }
+    b->str_len = 0;
+    b->state = NORM_START;
+    b->in_line = 0;
+}
+
+static int batch_chunk(const char *chunk, int n, void *ctx){
+    batch_t *b = ctx;
+    const char *p = chunk;
+    const char *end = chunk + n;
+
+    while (p < end){
+        const char *nl = memchr(p, '\n', end - p);
+        const char *stop = (nl != NULL) ? nl : end;
+
+        if (b->str_len >= 0 && stop > p){
+            long w = normalize(b->buff + b->str_len, BUFFER_SZ - b->str_len,
+                               p, stop - p, &b->state);
+            b->str_len = (w < 0) ? -1 : b->str_len + (int)w;
+        }
+        if (nl == NULL){
+            b->in_line = 1;
+            break;
+        }
+        batch_line(b);
+        p = nl + 1;
+    }
+    return 0;
+}
+
+//runs -L<ops> over a file, or stdin if none is given: every line is one
+//input string for ops (c, r, w, x with find and replace before the file,
+//or several of c, r and w as for fused_ops()).  A line that fails prints
+//the error a single invocation would and the rest go on, the exit code is
+//then 2.
+int run_batch(char *exename, char *ops, int argc, char **args){
+    char buff[BUFFER_SZ];
+    batch_t b = {ops, NULL, NULL, buff, 0, NORM_START, 0, 0};
+    char *path;
+    int fd;
+    int rc;
+
+    if (strcmp(ops, "x") == 0 && argc >= 2 && *args[0] != '\0'){
+        b.find = args[0];
+        b.repl = args[1];
+        args += 2;
+        argc -= 2;
+    } else if (strcmp(ops, "c") != 0 && strcmp(ops, "r") != 0 && strcmp(ops, "w") != 0
+               && !fused_valid(ops)){
+        usage(exename);
+        return 1;
+    }
+    if (argc > 1){
+        usage(exename);
+        return 1;
+    }
+    path = (argc > 0) ? args[0] : NULL;
+    fd = stream_open(path);
+    if (fd < 0){
+        out_error("Error opening %s\n", path);
+        return 2;
+    }
+
+    rc = stream_chunks(fd, batch_chunk, &b);
+    if (rc == 0 && b.in_line){
+        batch_line(&b);     //the last line had no newline
+    }
+    if (rc == 0){
+        rc = out_flush();
+    }
+    if (fd != STDIN_FILENO){
+        close(fd);
+    }
+    if (rc < 0){
+        out_error("Error reading lines, rc = %d\n", rc);
+        return 2;
+    }
+    return b.failed ? 2 : 0;
+}
+
 int main(int argc, char *argv[]){
 
     char *buff;             //placehoder for the internal buffer
@@ -219,6 +482,44 @@ int main(int argc, char *argv[]){
         exit(0);
     }
 
+    //-L<ops> runs ops on every line of a file or stdin, see run_batch()
+    if (opt == 'L' && *(argv[1]+2) != '\0'){
+        exit(run_batch(argv[0], argv[1]+2, argc - 2, argv + 2));
+    }
+
+    //a trailing 's' streams the input from a file or stdin instead of
+    //the command line, see sf_stream.h
+    if (*(argv[1]+2) == 's' && *(argv[1]+3) == '\0'){
+        exit(run_stream(argv[0], opt, argc - 2, argv + 2));
+    }
+
+    //-f [topK] [file] lists the most frequent words, see sf_freq.h
+    if (opt == 'f' && *(argv[1]+2) == '\0'){
+        exit(run_freq(argv[0], argc - 2, argv + 2));
+    }
+
+    //-c -j N file counts a mapped file on N threads, see sf_mmap.h.  N
+    //has to be a number and nothing else, "-c -j 4x f" is a usage error
+    if (opt == 'c' && argc >= 3 && strcmp(argv[2], "-j") == 0){
+        char *end = NULL;
+        long nthreads = (argc == 5) ? strtol(argv[3], &end, 10) : 0;
+        long words;
+
+        if (nthreads < 1 || nthreads > MMAP_MAX_THREADS || *end != '\0'){
+            usage(argv[0]);
+            exit(1);
+        }
+        words = parallel_count_words(argv[4], (int)nthreads);
+        if (words < 0){
+            out_error("Error counting words in %s, rc = %ld\n", argv[4], words);
+            exit(2);
+        }
+        out_str("Word Count: ");
+        out_long(words);
+        out_char('\n');
+        exit(0);
+    }
+
     //WE NOW WILL HANDLE THE REQUIRED OPERATIONS
 
     //TODO:  #2 Document the purpose of the if statement below
@@ -233,6 +534,12 @@ int main(int argc, char *argv[]){
         exit(1);
     }
 
+    //-crw and the like share one setup_buff(), see fused_ops()
+    if (*(argv[1]+2) != '\0' && !fused_valid(argv[1]+1)){
+        usage(argv[0]);
+        exit(1);
+    }
+
     input_string = argv[2]; //capture the user input string
 
     //TODO:  #3 Allocate space for the buffer using malloc and
@@ -249,32 +556,55 @@ int main(int argc, char *argv[]){
 
     user_str_len = setup_buff(buff, input_string, BUFFER_SZ);     //see todos
     if (user_str_len < 0){
-        printf("Error setting up buffer, error = %d", user_str_len);
+        out_error("Error setting up buffer, error = %d", user_str_len);
         exit(2);
     }
 
+    if (*(argv[1]+2) != '\0'){
+        fused_ops(buff, BUFFER_SZ, user_str_len, argv[1]+1);
+        print_buff(buff, BUFFER_SZ);
+        free(buff);
+        exit(0);
+    }
+
     switch (opt){
         case 'c':
             rc = count_words(buff, BUFFER_SZ, user_str_len);  //you need to implement
             if (rc < 0){
-                printf("Error counting words, rc = %d", rc);
+                out_error("Error counting words, rc = %d", rc);
                 exit(2);
             }
             break;
         case 'r':
             rc = reverse_string(buff, BUFFER_SZ, user_str_len);
             if (rc < 0){
-                printf("Error reversing string, rc = %d", rc);
+                out_error("Error reversing string, rc = %d", rc);
                 exit(2);
             }
             break;
         case 'w':
             rc = word_print(buff, BUFFER_SZ, user_str_len);
             if (rc < 0){
-                printf("Error printing words, rc = %d", rc);
+                out_error("Error printing words, rc = %d", rc);
                 exit(2);
             }
             break;
+        case 'x':
+            if (argc != 5){
+                usage(argv[0]);
+                exit(1);
+            }
+            rc = replace_string(buff, BUFFER_SZ, user_str_len, argv[3], argv[4]);
+            if (rc < 0){
+                out_error("Error replacing string, rc = %d", rc);
+                exit(2);
+            }
+            //-x shows the buffer in brackets, so the padding is visible
+            out_str("Buffer:  [");
+            out_bytes(buff, BUFFER_SZ);
+            out_str("]\n");
+            free(buff);
+            exit(0);
 
         //TODO:  #5 Implement the other cases for 'r' and 'w' by extending
         //       the case statement options
@@ -284,8 +614,8 @@ int main(int argc, char *argv[]){
     }
 
     //TODO:  #6 Dont forget to free your buffer before exiting
-    free(buff);
     print_buff(buff,BUFFER_SZ);
+    free(buff);
     exit(0);
 }
 
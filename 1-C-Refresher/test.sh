@@ -98,3 +98,115 @@ Buffer:  Lets get a lot of words to test..................." ]
     [ "$output" = "Buffer:  [This is a super long string for testing my app....]" ] || 
     [ "$output" = "Not Implemented!" ]
 }
+
+@test "stream word count and normalize from stdin" {
+    run bash -c "printf '  one two\n\n three\t four  ' | ./stringfun -cs"
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Count: 4" ]
+
+    run bash -c "printf '  one two\n\n three\t four  ' | ./stringfun -ns"
+    [ "$status" -eq 0 ]
+    [ "$output" = "one two three four" ]
+}
+
+@test "vector and scalar normalizers agree" {
+    input="$(printf '\t\t lead%.0s  \n' {1..40}) $(printf 'w%.0s' {1..150})  tail "
+    run ./stringfun -ns <<< "$input"
+    [ "$status" -eq 0 ]
+    simd_output="$output"
+    run env STRINGFUN_SCALAR=1 ./stringfun -ns <<< "$input"
+    [ "$output" = "$simd_output" ]
+    [ "$output" = "$(echo $input)" ]
+}
+
+@test "bitmask word count matches wc across blocks" {
+    input="$(for i in $(seq 1 500); do printf 'w%d%*s' $i $((i % 70)) ''; done)"
+    run ./stringfun -cs <<< "$input"
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Count: $(echo "$input" | wc -w)" ]
+}
+
+@test "parallel word count matches the serial count" {
+    input_file=$(mktemp)
+    for i in $(seq 1 2000); do printf 'word%d%*s' $i $((i % 9)) ''; done > "$input_file"
+    run ./stringfun -c -j 7 "$input_file"
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Count: $(wc -w < "$input_file")" ]
+    rm -f "$input_file"
+}
+
+@test "parallel word count rejects a bad thread count" {
+    input_file=$(mktemp)
+    echo "a few words" > "$input_file"
+    run ./stringfun -c -j 4x "$input_file"
+    [ "$status" -eq 1 ]
+    run ./stringfun -c -j "$input_file"
+    [ "$status" -eq 1 ]
+    run ./stringfun -c -j 2 "$input_file" extra
+    [ "$status" -eq 1 ]
+    rm -f "$input_file"
+}
+
+@test "mapped reverse matches the reversed normalized input" {
+    input_file=$(mktemp)
+    for i in $(seq 1 30000); do printf 'rev%d%*s' $i $((i % 5)) ''; done > "$input_file"
+    run ./stringfun -rs "$input_file"
+    [ "$status" -eq 0 ]
+    [ "$output" = "$(./stringfun -ns "$input_file" | rev)" ]
+    run env STRINGFUN_SCALAR=1 ./stringfun -rs < "$input_file"
+    [ "$output" = "$(./stringfun -ns "$input_file" | rev)" ]
+    rm -f "$input_file"
+}
+
+@test "buffered word listing is complete through a pipe" {
+    input="$(for i in $(seq 1 20000); do printf 'w%d ' $i; done)"
+    run bash -c "./stringfun -ws <<< '$input' | tail -n 2"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "20000. w20000 (6)" ]
+    [ "${lines[1]}" = "Number of words returned: 20000" ]
+}
+
+@test "word frequency lists the top words by count" {
+    run bash -c "printf 'the cat\tand the dog\n and the  end' | ./stringfun -f 2"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Word Frequency" ]
+    [ "${lines[2]}" = "1. the (3)" ]
+    [ "${lines[3]}" = "2. and (2)" ]
+    [ "${lines[4]}" = "Distinct words: 5, total words: 8" ]
+}
+
+@test "streamed replace across chunk boundaries" {
+    input_file=$(mktemp)
+    for i in $(seq 1 40000); do printf 'key=%d needle ' $i; done > "$input_file"
+    run bash -c "./stringfun -xs needle pin '$input_file' | sed 's/pin/needle/g' | cmp - '$input_file'"
+    [ "$status" -eq 0 ]
+    [ "$(./stringfun -xs needle pin "$input_file" | grep -o pin | wc -l)" -eq 40000 ]
+    rm -f "$input_file"
+}
+
+@test "batch lines match single invocations" {
+    run bash -c "printf 'one two\n  three   four five  \nsix' | ./stringfun -Lc"
+    [ "$status" -eq 0 ]
+    [ "$output" = "$(./stringfun -c 'one two'; ./stringfun -c '  three   four five  '; ./stringfun -c six)" ]
+    run bash -c "printf 'This is a bad test\nnothing here\n' | ./stringfun -Lx bad great"
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Buffer:  [This is a great test..............................]" ]
+    [ "${lines[1]}" = "Error replacing string, rc = -2" ]
+}
+
+@test "fused options run in one pass" {
+    run ./stringfun -crw "  Lets get   a lot "
+    [ "$status" -eq 0 ]
+    [ "$output" = "Word Count: 4
+Reversed String: tol a teg steL
+Word Print
+----------
+1. Lets (4)
+2. get (3)
+3. a (1)
+4. lot (3)
+Number of words returned: 4
+Buffer:  Lets get a lot...................................." ]
+    run ./stringfun -cc "twice"
+    [ "$status" -eq 1 ]
+}
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "libsdb.h"
+#include "sdb_bloom.h"
+#include "sdb_cache.h"
+#include "sdb_compact.h"
+#include "sdb_log.h"
+
+//an open database, see sdb_open()
+struct sdb
+{
+    int fd;
+    char path[PATH_BUF_SZ];
+};
+
+/*
+ *  db_add
+ *      fd:  linux file descriptor of a slot format database
+ *      *s:  the student to add, the names need not be terminated
+ *
+ *  Writes s to its slot if the slot is empty, then updates the name filter,
+ *  logs the change and updates the slot cache.
+ *
+ *  returns:  NO_ERROR, ERR_DB_RANGE, ERR_DB_EXISTS, ERR_DB_READONLY,
+ *            ERR_DB_FILE or ERR_DB_LOG (the student was added)
+ *
+ *  console:  Does not produce any console I/O
+ */
+int db_add(int fd, const student_t *s)
+{
+    student_t student = EMPTY_STUDENT_RECORD;
+    off_t offset = (off_t)s->id * sizeof(student_t);
+    ssize_t bytes_read;
+    int rc;
+
+    if (db_is_compact(fd))
+        return ERR_DB_READONLY;
+    if (validate_range(s->id, s->gpa) != NO_ERROR)
+        return ERR_DB_RANGE;
+
+    // a slot past EOF reads short and is free
+    bytes_read = pread(fd, &student, sizeof(student_t), offset);
+    if (bytes_read == -1)
+        return ERR_DB_FILE;
+    if (bytes_read == sizeof(student_t) && student.id != DELETED_STUDENT_ID)
+        return ERR_DB_EXISTS;
+
+    memset(&student, 0, sizeof(student));
+    student.id = s->id;
+    strncpy(student.fname, s->fname, sizeof(student.fname) - 1);
+    strncpy(student.lname, s->lname, sizeof(student.lname) - 1);
+    student.gpa = s->gpa;
+
+    if (pwrite(fd, &student, sizeof(student_t), offset) != sizeof(student_t))
+        return ERR_DB_FILE;
+
+    bloom_add(fd, &student);
+    rc = (log_event(fd, LOG_OP_ADD, &student) == NO_ERROR) ? NO_ERROR : ERR_DB_LOG;
+    cache_put(fd, s->id, &student);     //after the log, see cache_put()
+    return rc;
+}
+
+/*
+ *  db_get
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking for
+ *      *s:  where the student is copied if found
+ *
+ *  Direct lookup: the directory of a compact database, the slot cache if
+ *  a session turned it on, otherwise one read of the slot of id.  The
+ *  format is checked first, another process may have converted the file
+ *  with -K since the cache was filled.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int db_get(int fd, int id, student_t *s)
+{
+    student_t temp;
+    ssize_t bytes_read;
+
+    if (db_is_compact(fd))
+        return compact_get(fd, id, s);
+    if (cache_active())
+        return cache_get(fd, id, s);
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return SRCH_NOT_FOUND;
+
+    bytes_read = pread(fd, &temp, sizeof(student_t), (off_t)id * sizeof(student_t));
+    if (bytes_read == -1)
+        return ERR_DB_FILE;
+    if (bytes_read != sizeof(student_t) || temp.id != id)
+        return SRCH_NOT_FOUND;
+
+    memcpy(s, &temp, sizeof(student_t));
+    return NO_ERROR;
+}
+
+/*
+ *  db_del
+ *      fd:  linux file descriptor of a slot format database
+ *      id:  student id to be deleted
+ *
+ *  Clears the slot of id, then logs the change and updates the slot cache.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND, ERR_DB_READONLY, ERR_DB_FILE or
+ *            ERR_DB_LOG (the student was deleted)
+ *
+ *  console:  Does not produce any console I/O
+ */
+int db_del(int fd, int id)
+{
+    student_t empty_student = EMPTY_STUDENT_RECORD;
+    student_t existing;
+    int rc;
+
+    if (db_is_compact(fd))
+        return ERR_DB_READONLY;
+    if ((rc = db_get(fd, id, &existing)) != NO_ERROR)
+        return rc;
+
+    if (pwrite(fd, &empty_student, sizeof(student_t), (off_t)id * sizeof(student_t)) !=
+        sizeof(student_t))
+        return ERR_DB_FILE;
+
+    // the log record carries the id
+    empty_student.id = id;
+    rc = (log_event(fd, LOG_OP_DEL, &empty_student) == NO_ERROR) ? NO_ERROR : ERR_DB_LOG;
+    empty_student.id = DELETED_STUDENT_ID;
+    cache_put(fd, id, &empty_student);  //after the log, see cache_put()
+    return rc;
+}
+
+/*
+ *  sdb_open
+ *      dbFile:  database file, created if it does not exist
+ *      flags:   SDB_OPEN_TRUNC or 0
+ *      **db:    set to the new handle
+ *
+ *  Opens dbFile with its change log and, if it has one, its name filter.
+ *  SDB_OPEN_TRUNC then empties it with zero_db(), as -z does.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ */
+int sdb_open(const char *dbFile, int flags, sdb_t **db)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    sdb_t *h;
+
+    if ((h = malloc(sizeof(*h))) == NULL)
+        return ERR_DB_FILE;
+    snprintf(h->path, sizeof(h->path), "%s", dbFile);
+
+    h->fd = open(dbFile, O_RDWR | O_CREAT, mode);
+    if (h->fd < 0)
+    {
+        free(h);
+        return ERR_DB_FILE;
+    }
+    if (log_attach(h->fd, h->path) != NO_ERROR)
+    {
+        close(h->fd);
+        free(h);
+        return ERR_DB_FILE;
+    }
+    bloom_attach(h->fd, h->path);
+
+    // a truncated database starts over, with the change log lock held as -z
+    if ((flags & SDB_OPEN_TRUNC) && zero_db(h->fd, h->path) != NO_ERROR)
+    {
+        sdb_close(h);
+        return ERR_DB_FILE;
+    }
+
+    *db = h;
+    return NO_ERROR;
+}
+
+void sdb_close(sdb_t *db)
+{
+    if (db == NULL)
+        return;
+    bloom_detach(db->fd);
+    log_detach(db->fd);
+    close(db->fd);
+    free(db);
+}
+
+//add and delete hold the change log lock so -x never swaps the file
+//between the read and the write of a slot
+int sdb_add(sdb_t *db, int id, const char *fname, const char *lname, int gpa)
+{
+    student_t s = EMPTY_STUDENT_RECORD;
+    int rc;
+
+    s.id = id;
+    strncpy(s.fname, fname, sizeof(s.fname) - 1);
+    strncpy(s.lname, lname, sizeof(s.lname) - 1);
+    s.gpa = gpa;
+
+    if ((rc = log_begin(db->fd)) == NO_ERROR)
+        rc = db_add(db->fd, &s);
+    log_end(db->fd);
+    return rc;
+}
+
+//readers follow the file to its new inode after an online -x, see
+//log_follow()
+int sdb_get(sdb_t *db, int id, student_t *s)
+{
+    if (log_follow(db->fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    return db_get(db->fd, id, s);
+}
+
+int sdb_del(sdb_t *db, int id)
+{
+    int rc;
+
+    if ((rc = log_begin(db->fd)) == NO_ERROR)
+        rc = db_del(db->fd, id);
+    log_end(db->fd);
+    return rc;
+}
+
+/*
+ *  sdb_add_many
+ *      db:    an open database
+ *      recs:  the students to add
+ *      n:     number of students
+ *      rcs:   NULL, or n return codes of db_add(), one per student
+ *
+ *  Adds every student it can under a single hold of the change log lock.
+ *  One student failing does not stop the others.
+ *
+ *  returns:  the number of students added, or ERR_DB_FILE if the log
+ *            could not be locked
+ */
+int sdb_add_many(sdb_t *db, const student_t *recs, int n, int *rcs)
+{
+    int added = 0;
+
+    if (log_begin(db->fd) != NO_ERROR)
+    {
+        log_end(db->fd);
+        return ERR_DB_FILE;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        int rc = db_add(db->fd, &recs[i]);
+
+        if (rc == NO_ERROR || rc == ERR_DB_LOG)
+            added++;
+        if (rcs != NULL)
+            rcs[i] = rc;
+    }
+    log_end(db->fd);
+    return added;
+}
+
+/*
+ *  sdb_get_many
+ *      db:   an open database
+ *      ids:  the ids to look up
+ *      n:    number of ids
+ *      out:  n students, out[i] is filled in if ids[i] is found
+ *      rcs:  NULL, or n return codes of db_get(), one per id
+ *
+ *  returns:  the number of students found, or ERR_DB_FILE
+ */
+int sdb_get_many(sdb_t *db, const int *ids, int n, student_t *out, int *rcs)
+{
+    int found = 0;
+
+    if (log_follow(db->fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    for (int i = 0; i < n; i++)
+    {
+        int rc = db_get(db->fd, ids[i], &out[i]);
+
+        if (rc == NO_ERROR)
+            found++;
+        if (rcs != NULL)
+            rcs[i] = rc;
+    }
+    return found;
+}
+
+//returns:  the number of students, or ERR_DB_FILE
+int sdb_count(sdb_t *db)
+{
+    int count = 0;
+    int rc = log_follow(db->fd);
+
+    if (rc == NO_ERROR)
+        rc = scan_db(db->fd, count_record, &count);
+
+    return (rc == NO_ERROR) ? count : rc;
+}
+
+//hands every student to fn in id order, see scan_db()
+int sdb_foreach(sdb_t *db, scan_fn fn, void *ctx)
+{
+    if (log_follow(db->fd) != NO_ERROR)
+        return ERR_DB_FILE;
+    return scan_db(db->fd, fn, ctx);
+}
@@ -0,0 +1,45 @@
+#ifndef __LIBSDB_H__
+    #define __LIBSDB_H__
+
+#include "db.h"
+#include "sdbsc.h"
+
+//libsdb.  The student database as a library, for programs that want the
+//records without running sdbsc.  `make` builds libsdb.a and libsdb.so from
+//the same sources as sdbsc (without its main()), link with -lsdb -lpthread.
+//
+//No libsdb function writes to the console.  Every outcome is a return
+//code from sdbsc.h: NO_ERROR, SRCH_NOT_FOUND, ERR_DB_FILE and the finer
+//ERR_DB_RANGE, ERR_DB_EXISTS, ERR_DB_READONLY and ERR_DB_LOG.
+//
+//A handle is one open database file with its change log (sdb_log.h) and
+//name filter (sdb_bloom.h), so replicas, -x and -n stay in step with
+//changes made through it.  Sharded databases are not supported.  Threads
+//may each open and use their own handles at the same time, a handle is
+//never to be used by two threads at once.  At most SHARD_MAX + 1 (65)
+//handles and sdbsc databases can be open in a process together, past
+//that sdb_open() returns ERR_DB_FILE.
+//
+//The fd level db_add(), db_get() and db_del() are the operations behind
+//both the handles and sdbsc's add_student(), get_student() and
+//del_student().  Writers must hold the change log lock, see log_begin().
+#define SDB_OPEN_TRUNC      0x01    //start with an empty database
+
+typedef struct sdb sdb_t;
+
+//prototypes for libsdb.c
+int sdb_open(const char *dbFile, int flags, sdb_t **db);
+void sdb_close(sdb_t *db);
+int sdb_add(sdb_t *db, int id, const char *fname, const char *lname, int gpa);
+int sdb_get(sdb_t *db, int id, student_t *s);
+int sdb_del(sdb_t *db, int id);
+int sdb_add_many(sdb_t *db, const student_t *recs, int n, int *rcs);
+int sdb_get_many(sdb_t *db, const int *ids, int n, student_t *out, int *rcs);
+int sdb_count(sdb_t *db);
+int sdb_foreach(sdb_t *db, scan_fn fn, void *ctx);
+
+int db_add(int fd, const student_t *s);
+int db_get(int fd, int id, student_t *s);
+int db_del(int fd, int id);
+
+#endif
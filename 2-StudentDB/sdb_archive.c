@@ -0,0 +1,571 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_archive.h"
+#include "sdb_bloom.h"
+#include "sdb_compact.h"
+#include "sdb_log.h"
+#include "sdb_shard.h"
+
+_Static_assert(sizeof(student_t) == ARCH_REC_SZ, "archive records mirror student_t");
+
+#define FNV64_BASIS     14695981039346656037ull
+#define FNV64_PRIME     1099511628211ull
+
+static uint64_t fnv64(uint64_t h, const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= FNV64_PRIME;
+    }
+    return h;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static void encode_rec(uint8_t *p, const student_t *s)
+{
+    put_le32(p, (uint32_t)s->id);
+    memcpy(p + 4, s->fname, sizeof(s->fname));
+    memcpy(p + 4 + sizeof(s->fname), s->lname, sizeof(s->lname));
+    put_le32(p + 4 + sizeof(s->fname) + sizeof(s->lname), (uint32_t)s->gpa);
+}
+
+static void decode_rec(const uint8_t *p, student_t *s)
+{
+    s->id = (int)get_le32(p);
+    memcpy(s->fname, p + 4, sizeof(s->fname));
+    memcpy(s->lname, p + 4 + sizeof(s->fname), sizeof(s->lname));
+    s->gpa = (int)get_le32(p + 4 + sizeof(s->fname) + sizeof(s->lname));
+
+    // never trust the terminators of data from another host
+    s->fname[sizeof(s->fname) - 1] = '\0';
+    s->lname[sizeof(s->lname) - 1] = '\0';
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  ---------------------------------------------------------------------
+ *  dump
+ *  ---------------------------------------------------------------------
+ */
+
+//one frame of the archive, filled in by its own reader thread
+typedef struct arch_part
+{
+    int fd;
+    int min_id;             //slots read, inclusive
+    int max_id;
+    bool serial;            //compact database, read with scan_db()
+    uint8_t *buf;           //frame header followed by the records
+    size_t len;
+    size_t cap;
+    uint32_t nrecs;
+    int rc;
+    pthread_t tid;
+    bool started;
+} arch_part_t;
+
+static int part_add(const student_t *s, void *ctx)
+{
+    arch_part_t *p = ctx;
+
+    if (p->len + ARCH_REC_SZ > p->cap)
+    {
+        size_t cap = p->cap * 2;
+        uint8_t *buf = realloc(p->buf, cap);
+        if (buf == NULL)
+            return ERR_DB_FILE;
+        p->buf = buf;
+        p->cap = cap;
+    }
+    encode_rec(p->buf + p->len, s);
+    p->len += ARCH_REC_SZ;
+    p->nrecs++;
+    return NO_ERROR;
+}
+
+//reads the live records of slots min_id..max_id, skipping holes
+static int read_part(arch_part_t *p, student_t *block)
+{
+    off_t offset = (off_t)p->min_id * sizeof(student_t);
+    off_t end = ((off_t)p->max_id + 1) * sizeof(student_t);
+
+    while (offset < end)
+    {
+        off_t data = lseek(p->fd, offset, SEEK_DATA);
+        if (data == -1)
+            return (errno == ENXIO) ? NO_ERROR : ERR_DB_FILE;
+        if (data > offset)
+            offset = data - (data % sizeof(student_t));
+        if (offset >= end)
+            break;
+
+        size_t want = (end - offset < SCAN_BLOCK_SZ) ? end - offset : SCAN_BLOCK_SZ;
+        ssize_t n = pread(p->fd, block, want, offset);
+        if (n < 0)
+            return ERR_DB_FILE;
+        if (n == 0)
+            break;
+
+        for (int i = 0; i < (int)(n / sizeof(student_t)); i++)
+            if (block[i].id != DELETED_STUDENT_ID && part_add(&block[i], p) != NO_ERROR)
+                return ERR_DB_FILE;
+        offset += n;
+    }
+    return NO_ERROR;
+}
+
+static void *part_main(void *arg)
+{
+    arch_part_t *p = arg;
+    student_t *block;
+
+    p->cap = ARCH_FRAME_HDR_SZ + 64 * ARCH_REC_SZ;
+    p->len = ARCH_FRAME_HDR_SZ;
+    p->buf = malloc(p->cap);
+    block = malloc(SCAN_BLOCK_SZ);
+    if (p->buf == NULL || block == NULL)
+        p->rc = ERR_DB_FILE;
+    else if (p->serial)
+        p->rc = scan_db(p->fd, part_add, p);
+    else
+        p->rc = read_part(p, block);
+    free(block);
+
+    if (p->rc == NO_ERROR)
+    {
+        uint8_t *recs = p->buf + ARCH_FRAME_HDR_SZ;
+        memcpy(p->buf, ARCH_FRAME_MAGIC, 4);
+        put_le32(p->buf + 4, p->nrecs);
+        put_le64(p->buf + 8, fnv64(FNV64_BASIS, recs, p->len - ARCH_FRAME_HDR_SZ));
+    }
+    return NULL;
+}
+
+/*
+ *  plan_parts
+ *
+ *  Splits the database into the frames of the archive: one per shard, one
+ *  for a compact database, otherwise the used part of the id range cut
+ *  into one range per CPU.
+ *
+ *  returns:  the number of parts
+ */
+static int plan_parts(int fd, shard_set_t *shards, arch_part_t *parts)
+{
+    struct stat st;
+    int n;
+
+    if (shards->n > 0)
+    {
+        for (int i = 0; i < shards->n; i++)
+        {
+            parts[i].fd = shards->shards[i].fd;
+            parts[i].min_id = shards->shards[i].min_id;
+            parts[i].max_id = shards->shards[i].max_id;
+            parts[i].serial = db_is_compact(parts[i].fd);
+        }
+        return shards->n;
+    }
+
+    if (db_is_compact(fd) || fstat(fd, &st) == -1)
+    {
+        parts[0].fd = fd;
+        parts[0].serial = true;
+        return 1;
+    }
+
+    int max_id = (int)(st.st_size / sizeof(student_t)) - 1;
+    if (max_id > MAX_STD_ID)
+        max_id = MAX_STD_ID;
+    if (max_id < MIN_STD_ID)
+        max_id = MIN_STD_ID;
+
+    n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (n > ARCH_MAX_THREADS)
+        n = ARCH_MAX_THREADS;
+
+    int per = (max_id - MIN_STD_ID + n) / n;
+    for (int i = 0; i < n; i++)
+    {
+        parts[i].fd = fd;
+        parts[i].min_id = MIN_STD_ID + i * per;
+        parts[i].max_id = parts[i].min_id + per - 1;
+        if (parts[i].max_id > max_id)
+            parts[i].max_id = max_id;
+    }
+    return n;
+}
+
+/*
+ *  dump_db
+ *      fd:       linux file descriptor of the database, -1 if sharded
+ *      shards:   the open shards of a sharded database, n is 0 otherwise
+ *      archive:  file to write, - for stdout
+ *
+ *  Writes the live records to archive in the format described in
+ *  sdb_archive.h.  Each frame is read by its own thread, then the frames
+ *  are written out in id order.
+ *
+ *  returns:  the number of records dumped, or ERR_DB_FILE
+ *
+ *  console:  M_DB_DUMP_OK (unless the archive goes to stdout),
+ *            M_ERR_ARCH_OPEN, M_ERR_DB_READ or M_ERR_DB_WRITE on errors
+ */
+int dump_db(int fd, shard_set_t *shards, const char *archive)
+{
+    arch_part_t parts[(SHARD_MAX > ARCH_MAX_THREADS) ? SHARD_MAX : ARCH_MAX_THREADS] = {0};
+    uint8_t hdr[ARCH_HDR_SZ] = {0};
+    bool to_stdout = (strcmp(archive, "-") == 0);
+    uint64_t count = 0;
+    uint64_t chksum = FNV64_BASIS;
+    int nparts = plan_parts(fd, shards, parts);
+    int out;
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < nparts; i++)
+    {
+        parts[i].started = (pthread_create(&parts[i].tid, NULL, part_main, &parts[i]) == 0);
+        if (!parts[i].started)
+            part_main(&parts[i]);
+    }
+    for (int i = 0; i < nparts; i++)
+    {
+        if (parts[i].started)
+            pthread_join(parts[i].tid, NULL);
+        if (parts[i].rc != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        goto done;
+    }
+
+    for (int i = 0; i < nparts; i++)
+    {
+        count += parts[i].nrecs;
+        chksum = fnv64(chksum, parts[i].buf + 8, 8);
+    }
+
+    memcpy(hdr, ARCH_MAGIC, 8);
+    put_le32(hdr + 8, ARCH_VERSION);
+    put_le32(hdr + 12, ARCH_REC_SZ);
+    put_le64(hdr + 16, count);
+    put_le32(hdr + 24, nparts);
+    put_le64(hdr + 32, chksum);
+
+    out = to_stdout ? STDOUT_FILENO
+                    : open(archive, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (out < 0)
+    {
+        printf(M_ERR_ARCH_OPEN, archive);
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    rc = write_all(out, hdr, sizeof(hdr));
+    for (int i = 0; i < nparts && rc == NO_ERROR; i++)
+        rc = write_all(out, parts[i].buf, parts[i].len);
+    if (!to_stdout && rc == NO_ERROR && fsync(out) == -1)
+        rc = ERR_DB_FILE;
+    if (!to_stdout && close(out) != 0)
+        rc = ERR_DB_FILE;
+
+    if (rc != NO_ERROR)
+        printf(M_ERR_DB_WRITE);
+    else if (!to_stdout)
+        printf(M_DB_DUMP_OK, (int)count, archive);
+
+done:
+    for (int i = 0; i < nparts; i++)
+        free(parts[i].buf);
+    return (rc == NO_ERROR) ? (int)count : rc;
+}
+
+/*
+ *  ---------------------------------------------------------------------
+ *  restore
+ *  ---------------------------------------------------------------------
+ */
+
+/*
+ *  write_recs
+ *
+ *  Writes n students, in ascending id order, to their slots with as few
+ *  pwritev() calls as possible.  Records in neighbouring slots share a
+ *  call, and so do records separated by a small gap, the gap being filled
+ *  from a page of zeros (the same thing an empty slot holds).  Gaps of a
+ *  page or more end the call, so they stay holes.
+ */
+static int write_recs(int fd, student_t *recs, int n)
+{
+    static const char zeros[4096];
+    struct iovec iov[ARCH_IOV_BATCH];
+    int i = 0;
+
+    while (i < n)
+    {
+        off_t start = (off_t)recs[i].id * sizeof(student_t);
+        off_t next = start;
+        size_t total = 0;
+        int niov = 0;
+
+        while (i < n && niov < ARCH_IOV_BATCH - 1)
+        {
+            off_t at = (off_t)recs[i].id * sizeof(student_t);
+            off_t gap = at - next;
+
+            if (gap >= (off_t)sizeof(zeros))
+                break;
+            if (gap > 0)
+            {
+                iov[niov].iov_base = (void *)zeros;
+                iov[niov++].iov_len = gap;
+            }
+
+            // neighbouring records are contiguous in recs too
+            int run = 1;
+            while (i + run < n && recs[i + run].id == recs[i].id + run)
+                run++;
+            iov[niov].iov_base = &recs[i];
+            iov[niov++].iov_len = run * sizeof(student_t);
+
+            next = at + run * sizeof(student_t);
+            total += gap + run * sizeof(student_t);
+            i += run;
+        }
+
+        ssize_t w = pwritev(fd, iov, niov, start);
+        if (w != (ssize_t)total)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  restore_frames
+ *
+ *  Reads, checks and writes out the frames of an archive whose header was
+ *  already read.
+ *
+ *  returns:  the number of records restored, or ERR_DB_FILE if the archive
+ *            is damaged or a write failed
+ */
+static int restore_frames(int in, int fd, uint32_t nframes, uint64_t *chksum)
+{
+    uint8_t fhdr[ARCH_FRAME_HDR_SZ];
+    uint8_t *raw = NULL;
+    student_t *recs = NULL;
+    int last_id = 0;
+    int count = 0;
+    int rc = NO_ERROR;
+
+    *chksum = FNV64_BASIS;
+    for (uint32_t f = 0; f < nframes && rc == NO_ERROR; f++)
+    {
+        if (read_all(in, fhdr, sizeof(fhdr)) != NO_ERROR ||
+            memcmp(fhdr, ARCH_FRAME_MAGIC, 4) != 0)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        uint32_t n = get_le32(fhdr + 4);
+        if (n > MAX_STD_ID)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        raw = realloc(raw, (size_t)n * ARCH_REC_SZ + 1);
+        recs = realloc(recs, (size_t)n * sizeof(student_t) + 1);
+        if (raw == NULL || recs == NULL || read_all(in, raw, (size_t)n * ARCH_REC_SZ) != NO_ERROR ||
+            fnv64(FNV64_BASIS, raw, (size_t)n * ARCH_REC_SZ) != get_le64(fhdr + 8))
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        *chksum = fnv64(*chksum, fhdr + 8, 8);
+
+        for (uint32_t i = 0; i < n && rc == NO_ERROR; i++)
+        {
+            decode_rec(raw + (size_t)i * ARCH_REC_SZ, &recs[i]);
+            if (recs[i].id <= last_id || recs[i].id > MAX_STD_ID)
+                rc = ERR_DB_FILE;
+            last_id = recs[i].id;
+        }
+        if (rc == NO_ERROR)
+            rc = write_recs(fd, recs, n);
+        count += n;
+    }
+
+    free(raw);
+    free(recs);
+    return (rc == NO_ERROR) ? count : rc;
+}
+
+//scan_db() callback for restore_db(), ctx points at the database fd
+static int log_restored(const student_t *s, void *ctx)
+{
+    return log_event(*(int *)ctx, LOG_OP_ADD, s);
+}
+
+/*
+ *  restore_db
+ *      fd:       linux file descriptor of the database
+ *      dbFile:   name of the database file
+ *      archive:  file written by dump_db(), - for stdin
+ *
+ *  Replaces the contents of the database with the records in archive.
+ *  They are written to a temporary file that is only renamed over dbFile
+ *  once every frame checksum, the record count and the archive checksum
+ *  have checked out, so a damaged archive leaves the database alone.
+ *  The restore is written to the change log as LOG_OP_ZERO and one
+ *  LOG_OP_ADD per record, so -R replicas end up with the same records.
+ *
+ *  returns:  the fd of the restored database, or ERR_DB_FILE
+ *
+ *  console:  M_DB_RESTORE_OK on success, M_ERR_ARCH_OPEN,
+ *            M_ERR_ARCH_FORMAT, M_ERR_DB_CREATE, M_ERR_LOG_WRITE on errors
+ */
+int restore_db(int fd, char *dbFile, const char *archive)
+{
+    uint8_t hdr[ARCH_HDR_SZ];
+    char tmp[PATH_BUF_SZ];
+    char filter[PATH_BUF_SZ];
+    bool from_stdin = (strcmp(archive, "-") == 0);
+    uint64_t chksum;
+    int in, tmp_fd;
+    int count = ERR_DB_FILE;
+
+    in = from_stdin ? STDIN_FILENO : open(archive, O_RDONLY);
+    if (in < 0)
+    {
+        printf(M_ERR_ARCH_OPEN, archive);
+        return ERR_DB_FILE;
+    }
+
+    tmp_db_path(dbFile, tmp, sizeof(tmp));
+    tmp_fd = open_db(tmp, true);
+    if (tmp_fd < 0)
+    {
+        if (!from_stdin)
+            close(in);
+        return ERR_DB_FILE;
+    }
+
+    if (read_all(in, hdr, sizeof(hdr)) == NO_ERROR && memcmp(hdr, ARCH_MAGIC, 8) == 0 &&
+        get_le32(hdr + 8) == ARCH_VERSION && get_le32(hdr + 12) == ARCH_REC_SZ)
+    {
+        count = restore_frames(in, tmp_fd, get_le32(hdr + 24), &chksum);
+        if (count >= 0 && ((uint64_t)count != get_le64(hdr + 16) || chksum != get_le64(hdr + 32)))
+            count = ERR_DB_FILE;
+    }
+    if (!from_stdin)
+        close(in);
+
+    if (count < 0)
+    {
+        printf(M_ERR_ARCH_FORMAT, archive);
+        close(tmp_fd);
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+
+    if (fsync(tmp_fd) == -1 || rename(tmp, dbFile) == -1)
+    {
+        printf(M_ERR_DB_CREATE);
+        close(tmp_fd);
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+
+    // the names changed wholesale, the filter is rebuilt on first use
+    snprintf(filter, sizeof(filter), "%s%s", dbFile, BLOOM_FILE_SUFFIX);
+    bloom_detach(fd);
+    unlink(filter);
+
+    // keep the caller's fd number, like compress_db()
+    if (dup2(tmp_fd, fd) == -1)
+        fd = tmp_fd;
+    else
+        close(tmp_fd);
+
+    // replicas see the restore as a truncate followed by one add per
+    // record, the caller holds the log lock so no other change interleaves
+    if (log_event(fd, LOG_OP_ZERO, NULL) != NO_ERROR || scan_db(fd, log_restored, &fd) != NO_ERROR)
+        printf(M_ERR_LOG_WRITE);
+
+    printf(M_DB_RESTORE_OK, count, archive);
+    return fd;
+}
@@ -0,0 +1,51 @@
+#ifndef __SDB_ARCHIVE_H__
+    #define __SDB_ARCHIVE_H__
+
+#include <stdint.h>
+
+#include "db.h"
+#include "sdb_shard.h"
+
+//Archive format (-D / -L).  A portable image of the live records of a
+//database, independent of the host byte order and of the on disk format
+//(slot, compact or sharded) it was taken from.  All integers are little
+//endian.
+//
+//      header   ARCH_HDR_SZ bytes
+//                 magic[8]  ARCH_MAGIC
+//                 u32       version (ARCH_VERSION)
+//                 u32       record size (ARCH_REC_SZ)
+//                 u64       record count
+//                 u32       frame count
+//                 u32       reserved, 0
+//                 u64       checksum: FNV-1a of the frame checksums in order
+//                 24 bytes  reserved, 0
+//      frames   frame count of
+//                 magic[4]  ARCH_FRAME_MAGIC
+//                 u32       records in the frame
+//                 u64       checksum: FNV-1a of the frame's record bytes
+//                 records   ARCH_REC_SZ bytes each, in ascending id order
+//                             u32 id, fname[24], lname[32], u32 gpa
+//
+//Frames are written by independent readers, one per id range partition
+//(or per shard), and appear in id order.
+#define ARCH_MAGIC          "SDBARCH1"
+#define ARCH_FRAME_MAGIC    "FRM1"
+#define ARCH_VERSION        1
+#define ARCH_HDR_SZ         64
+#define ARCH_FRAME_HDR_SZ   16
+#define ARCH_REC_SZ         64
+#define ARCH_MAX_THREADS    16
+#define ARCH_IOV_BATCH      1024    //records per pwritev() on restore
+
+#define M_DB_DUMP_OK        "Dumped %d record(s) to %s.\n"
+#define M_DB_RESTORE_OK     "Restored %d record(s) from %s.\n"
+#define M_ERR_ARCH_OPEN     "Error opening archive %s, exiting!\n"
+#define M_ERR_ARCH_FORMAT   "Archive %s is damaged or not a student db archive!\n"
+#define M_ERR_ARCH_SHARDED  "Restoring into a sharded database is not supported, restore and split with -S.\n"
+
+//prototypes for sdb_archive.c
+int dump_db(int fd, shard_set_t *shards, const char *archive);
+int restore_db(int fd, char *dbFile, const char *archive);
+
+#endif
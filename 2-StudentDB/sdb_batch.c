@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_batch.h"
+#include "sdb_compact.h"
+#include "sdb_shard.h"
+
+/*
+ *  next_id
+ *      ids:  stream of whitespace separated student ids
+ *      *id:  where the next id is stored
+ *
+ *  Like the rest of sdbsc we assume the ids are numbers and convert them
+ *  with atoi(), anything else ends up as id 0 which is never found.
+ *
+ *  returns:  true if an id was read, false at EOF
+ */
+static bool next_id(FILE *ids, int *id)
+{
+    char tok[32];
+
+    if (fscanf(ids, "%31s", tok) != 1)
+        return false;
+
+    *id = atoi(tok);
+    return true;
+}
+
+/*
+ *  route_id
+ *      fd:      database fd used when the database is not sharded
+ *      shards:  shard set, NULL or empty if the database is not sharded
+ *      id:      the id being looked up
+ *
+ *  returns:  the fd of the database file that would hold id, or -1 if no
+ *            shard covers it
+ */
+static int route_id(int fd, const shard_set_t *shards, int id)
+{
+    shard_t *sh;
+
+    if (shards == NULL || shards->n == 0)
+        return fd;
+
+    sh = shard_for_id(shards, id);
+    return (sh == NULL) ? -1 : sh->fd;
+}
+
+/*
+ *  slot_matches
+ *      id:     the id that was looked up
+ *      *s:     the slot contents that were read
+ *      bytes:  how many bytes the read returned
+ *
+ *  returns:  true if the slot holds the requested student
+ */
+static bool slot_matches(int id, const student_t *s, ssize_t bytes)
+{
+    return bytes == sizeof(student_t) && s->id == id;
+}
+
+/*
+ *  ---------------------------------------------------------------------
+ *  io_uring path
+ *
+ *  There is no liburing in our build environment so the ring is set up
+ *  with the raw syscalls.  Each in-flight lookup owns one entry of the
+ *  reqs[] array, its index is carried through the ring as user_data.
+ *  ---------------------------------------------------------------------
+ */
+typedef struct batch_req
+{
+    int id;
+    struct iovec iov;
+    student_t rec;
+} batch_req_t;
+
+typedef struct uring
+{
+    int ring_fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+} uring_t;
+
+static void uring_close(uring_t *r)
+{
+    if (r->sqes != NULL && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED)
+        munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr, r->sq_len);
+    if (r->ring_fd >= 0)
+        close(r->ring_fd);
+}
+
+/*
+ *  uring_open
+ *      *r:       ring state to initialize
+ *      entries:  requested submission queue size
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_OP if io_uring is not usable on
+ *            this system (the caller should fall back to pread)
+ */
+static int uring_open(uring_t *r, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+
+    r->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->ring_fd < 0)
+        return ERR_DB_OP;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+    r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQES);
+    if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+        uring_close(r);
+        return ERR_DB_OP;
+    }
+
+    r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+    return NO_ERROR;
+}
+
+/*
+ *  uring_queue_read
+ *
+ *  Places a readv of req->rec at the slot for req->id on the submission
+ *  ring.  Nothing is handed to the kernel until io_uring_enter().
+ */
+static void uring_queue_read(uring_t *r, int fd, batch_req_t *req, unsigned tag)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    req->iov.iov_base = &req->rec;
+    req->iov.iov_len = sizeof(student_t);
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)&req->iov;
+    sqe->len = 1;
+    sqe->off = (unsigned long long)req->id * sizeof(student_t);
+    sqe->user_data = tag;
+
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int find_many_uring(int fd, const shard_set_t *shards, FILE *ids,
+                           int qdepth, batch_result_fn on_result, void *ctx)
+{
+    uring_t ring;
+    batch_req_t *reqs;
+    unsigned *free_tags;
+    int n_free = qdepth;
+    int pending = 0;    // queued on the ring but not yet taken by the kernel
+    int in_flight = 0;  // taken by the kernel, completion not reaped yet
+    int not_found = 0;
+    int rc = NO_ERROR;
+    bool eof = false;
+
+    if (uring_open(&ring, qdepth) != NO_ERROR)
+        return ERR_DB_OP;
+
+    reqs = malloc(qdepth * sizeof(batch_req_t));
+    free_tags = malloc(qdepth * sizeof(unsigned));
+    if (reqs == NULL || free_tags == NULL)
+    {
+        free(reqs);
+        free(free_tags);
+        uring_close(&ring);
+        return ERR_DB_FILE;
+    }
+    for (int i = 0; i < qdepth; i++)
+        free_tags[i] = i;
+
+    while (!eof || pending > 0 || in_flight > 0)
+    {
+        int id;
+
+        // top the queue back up to qdepth reads.  Ids that can never be
+        // in the database are answered right away without any I/O
+        while (!eof && n_free > 0)
+        {
+            if (!next_id(ids, &id))
+            {
+                eof = true;
+                break;
+            }
+            int id_fd = route_id(fd, shards, id);
+            if (id_fd < 0 || validate_range(id, MIN_STD_GPA) != NO_ERROR)
+            {
+                on_result(id, NULL, ctx);
+                not_found++;
+                continue;
+            }
+
+            unsigned tag = free_tags[--n_free];
+            reqs[tag].id = id;
+            uring_queue_read(&ring, id_fd, &reqs[tag], tag);
+            pending++;
+        }
+
+        if (pending == 0 && in_flight == 0)
+            continue;
+
+        int ret = (int)syscall(__NR_io_uring_enter, ring.ring_fd, pending,
+                               1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0)
+        {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+        }
+        else
+        {
+            pending -= ret;
+            in_flight += ret;
+        }
+
+        // reap everything that has completed so far
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            unsigned tag = (unsigned)cqe->user_data;
+            batch_req_t *req = &reqs[tag];
+
+            if (cqe->res < 0)
+                rc = ERR_DB_FILE;
+            else if (slot_matches(req->id, &req->rec, cqe->res))
+                on_result(req->id, &req->rec, ctx);
+            else
+            {
+                on_result(req->id, NULL, ctx);
+                not_found++;
+            }
+
+            free_tags[n_free++] = tag;
+            in_flight--;
+            head++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        if (rc != NO_ERROR)
+            break;
+    }
+
+    // close the ring before releasing the buffers it may still point at
+    uring_close(&ring);
+    free(reqs);
+    free(free_tags);
+
+    return (rc == NO_ERROR) ? not_found : rc;
+}
+
+/*
+ *  ---------------------------------------------------------------------
+ *  pread fallback
+ *
+ *  Each worker thread pulls the next id off the shared input stream and
+ *  does a blocking pread() of the slot, so up to nthreads reads are in
+ *  flight at once.  Results are reported under the same lock so the
+ *  callback never runs concurrently.
+ *  ---------------------------------------------------------------------
+ */
+typedef struct batch_pool
+{
+    pthread_mutex_t lock;
+    int fd;
+    const shard_set_t *shards;
+    FILE *ids;
+    batch_result_fn on_result;
+    void *ctx;
+    int not_found;
+    int rc;
+} batch_pool_t;
+
+static void *pread_worker(void *arg)
+{
+    batch_pool_t *pool = arg;
+    student_t rec;
+    int id;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        bool more = (pool->rc == NO_ERROR) && next_id(pool->ids, &id);
+        pthread_mutex_unlock(&pool->lock);
+        if (!more)
+            break;
+
+        ssize_t bytes = 0;
+        int id_fd = route_id(pool->fd, pool->shards, id);
+        if (id_fd >= 0 && validate_range(id, MIN_STD_GPA) == NO_ERROR)
+            bytes = pread(id_fd, &rec, sizeof(student_t),
+                          (off_t)id * sizeof(student_t));
+
+        pthread_mutex_lock(&pool->lock);
+        if (bytes < 0)
+            pool->rc = ERR_DB_FILE;
+        else if (slot_matches(id, &rec, bytes))
+            pool->on_result(id, &rec, pool->ctx);
+        else
+        {
+            pool->on_result(id, NULL, pool->ctx);
+            pool->not_found++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+static int find_many_pread(int fd, const shard_set_t *shards, FILE *ids,
+                           int qdepth, batch_result_fn on_result, void *ctx)
+{
+    pthread_t workers[BATCH_MAX_THREADS];
+    int nthreads = (qdepth < BATCH_MAX_THREADS) ? qdepth : BATCH_MAX_THREADS;
+    int started = 0;
+    batch_pool_t pool = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .fd = fd,
+        .shards = shards,
+        .ids = ids,
+        .on_result = on_result,
+        .ctx = ctx,
+        .not_found = 0,
+        .rc = NO_ERROR,
+    };
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&workers[i], NULL, pread_worker, &pool) != 0)
+            break;
+        started++;
+    }
+
+    // if no threads could be created at all just do the work inline
+    if (started == 0)
+        pread_worker(&pool);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    return (pool.rc == NO_ERROR) ? pool.not_found : pool.rc;
+}
+
+/*
+ *  find_many_serial
+ *
+ *  Compact databases have no fixed slot offsets, so each id is looked up
+ *  with get_student(), which goes through the slot directory, one at a
+ *  time.  These are small archival files that are normally in the page
+ *  cache.
+ */
+static int find_many_serial(int fd, const shard_set_t *shards, FILE *ids,
+                            batch_result_fn on_result, void *ctx)
+{
+    student_t rec;
+    int not_found = 0;
+    int id;
+
+    while (next_id(ids, &id))
+    {
+        int id_fd = route_id(fd, shards, id);
+        int rc = (id_fd < 0) ? SRCH_NOT_FOUND : get_student(id_fd, id, &rec);
+
+        if (rc == NO_ERROR)
+            on_result(id, &rec, ctx);
+        else if (rc == SRCH_NOT_FOUND)
+        {
+            on_result(id, NULL, ctx);
+            not_found++;
+        }
+        else
+            return rc;
+    }
+
+    return not_found;
+}
+
+//true if fd, or any of the shards, is a compact database
+static bool any_compact(int fd, const shard_set_t *shards)
+{
+    if (shards == NULL || shards->n == 0)
+        return db_is_compact(fd);
+
+    for (int i = 0; i < shards->n; i++)
+        if (db_is_compact(shards->shards[i].fd))
+            return true;
+    return false;
+}
+
+/*
+ *  find_many
+ *      fd:         linux file descriptor of the database
+ *      shards:     if the database is sharded, the open shards that ids are
+ *                  routed to (fd is then unused), otherwise NULL
+ *      ids:        stream of whitespace separated student ids
+ *      qdepth:     number of slot reads to keep in flight
+ *      flags:      BATCH_FORCE_PREAD to skip io_uring
+ *      on_result:  called once per id as its lookup completes
+ *      ctx:        passed through to on_result
+ *
+ *  Looks up every id in the stream.  Because student records are stored at
+ *  id * sizeof(student_t) each lookup is a single independent slot read,
+ *  so they are all queued up front instead of done one syscall at a time.
+ *  Results are streamed to on_result in completion order.
+ *
+ *  returns:  <number>       the number of ids that were not found
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O, on_result does the printing
+ */
+int find_many(int fd, const shard_set_t *shards, FILE *ids, int qdepth,
+              int flags, batch_result_fn on_result, void *ctx)
+{
+    int rc;
+
+    if (qdepth < 1)
+        qdepth = 1;
+    if (qdepth > BATCH_MAX_QDEPTH)
+        qdepth = BATCH_MAX_QDEPTH;
+
+    if (any_compact(fd, shards))
+        return find_many_serial(fd, shards, ids, on_result, ctx);
+
+    if (!(flags & BATCH_FORCE_PREAD))
+    {
+        rc = find_many_uring(fd, shards, ids, qdepth, on_result, ctx);
+        if (rc != ERR_DB_OP)
+            return rc;
+    }
+
+    return find_many_pread(fd, shards, ids, qdepth, on_result, ctx);
+}
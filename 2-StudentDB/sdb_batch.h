@@ -0,0 +1,30 @@
+#ifndef __SDB_BATCH_H__
+    #define __SDB_BATCH_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "db.h"
+#include "sdb_shard.h"
+
+//batched point lookups (-F).  Ids are read from a text stream, one or more
+//per line, and the slot reads for them are kept in flight on io_uring.  If
+//io_uring is not available (old kernel, seccomp, etc) a small pool of pread
+//worker threads is used instead.
+#define BATCH_DEF_QDEPTH    64      //default number of reads kept in flight
+#define BATCH_MAX_QDEPTH    4096    //upper bound for --qd=N
+#define BATCH_MAX_THREADS   64      //cap on pread fallback worker threads
+
+//flags for find_many()
+#define BATCH_FORCE_PREAD   0x01    //skip io_uring, use the pread fallback
+
+//callback invoked as each lookup completes (in completion order, not input
+//order).  s is NULL if the student was not found.  It is never called
+//concurrently, so it is free to print.
+typedef void (*batch_result_fn)(int id, const student_t *s, void *ctx);
+
+//prototypes for sdb_batch.c
+int find_many(int fd, const shard_set_t *shards, FILE *ids, int qdepth,
+              int flags, batch_result_fn on_result, void *ctx);
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_bloom.h"
+#include "sdb_log.h"
+#include "sdb_shard.h"
+
+//database fds with their name filter mapped, see bloom_attach().  A free
+//slot has db_fd -1 and slots are never moved, as in sdb_log.c.
+typedef struct bloom_link
+{
+    int db_fd;
+    uint8_t *map;       //header followed by the bit array, MAP_SHARED
+    size_t len;
+    uint32_t nbits;
+    uint32_t nhash;
+    dev_t dev;          //identity of the mapped filter file, see current_link()
+    ino_t ino;
+    char db_file[PATH_BUF_SZ];
+} bloom_link_t;
+
+static bloom_link_t links[SHARD_MAX + 1];
+static int n_links;
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//bit positions of a name come from one 64 bit hash, see bloom_bit()
+typedef struct bloom_key
+{
+    uint64_t h1;
+    uint64_t h2;
+} bloom_key_t;
+
+static void hash_bytes(uint64_t *h, const char *s, size_t max)
+{
+    size_t n = strnlen(s, max);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        *h ^= (unsigned char)s[i];
+        *h *= 1099511628211ull;
+    }
+}
+
+//names are hashed as add_student() stores them, cut to the field size
+static bloom_key_t name_key(const char *fname, const char *lname)
+{
+    uint64_t h = 14695981039346656037ull;
+    bloom_key_t k;
+
+    hash_bytes(&h, fname, sizeof(((student_t *)0)->fname) - 1);
+    hash_bytes(&h, "", 1);
+    h *= 1099511628211ull; // separator, so "ab" "c" != "a" "bc"
+    hash_bytes(&h, lname, sizeof(((student_t *)0)->lname) - 1);
+
+    k.h1 = h;
+    k.h2 = ((h >> 32) ^ (h * 0x9E3779B97F4A7C15ull)) | 1;
+    return k;
+}
+
+static uint32_t bloom_bit(bloom_key_t k, uint32_t i, uint32_t nbits)
+{
+    return (uint32_t)((k.h1 + i * k.h2) & (nbits - 1));
+}
+
+static bloom_link_t *find_link(int db_fd)
+{
+    bloom_link_t *l = NULL;
+
+    if (db_fd < 0)
+        return NULL;
+    pthread_mutex_lock(&links_lock);
+    for (int i = 0; i < n_links && l == NULL; i++)
+        if (links[i].db_fd == db_fd)
+            l = &links[i];
+    pthread_mutex_unlock(&links_lock);
+    return l;
+}
+
+//a free slot of links[], NULL if all are in use.  links_lock is held
+static bloom_link_t *free_link(void)
+{
+    for (int i = 0; i < n_links; i++)
+        if (links[i].db_fd < 0)
+            return &links[i];
+    if (n_links == (int)(sizeof(links) / sizeof(links[0])))
+        return NULL;
+    return &links[n_links++];
+}
+
+static void filter_path(const char *dbFile, char *buff, size_t len)
+{
+    snprintf(buff, len, "%s%s", dbFile, BLOOM_FILE_SUFFIX);
+}
+
+/*
+ *  bloom_attach
+ *      db_fd:   fd of an open database file
+ *      dbFile:  name of that database file
+ *
+ *  Maps the name filter of dbFile, if it has a valid one.  Without one
+ *  nothing is attached and bloom_may_contain() answers true, bloom_add()
+ *  tries to attach again in case the filter was built since.
+ *
+ *  returns:  NO_ERROR if the filter was attached, SRCH_NOT_FOUND if there
+ *            is no usable filter file
+ *
+ *  console:  Does not produce any console I/O
+ */
+int bloom_attach(int db_fd, const char *dbFile)
+{
+    char path[PATH_BUF_SZ];
+    bloom_hdr_t h;
+    struct stat st;
+    bloom_link_t *l;
+    uint8_t *map;
+    int fd;
+
+    if (find_link(db_fd) != NULL)
+        return NO_ERROR;
+
+    filter_path(dbFile, path, sizeof(path));
+    if ((fd = open(path, O_RDWR)) < 0)
+        return SRCH_NOT_FOUND;
+
+    if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || fstat(fd, &st) == -1 ||
+        memcmp(h.magic, BLOOM_MAGIC, sizeof(h.magic)) != 0 || h.version != BLOOM_VERSION ||
+        h.nbits == 0 || (h.nbits & (h.nbits - 1)) != 0 ||
+        st.st_size != (off_t)(sizeof(h) + h.nbits / 8))
+    {
+        close(fd);
+        return SRCH_NOT_FOUND;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return SRCH_NOT_FOUND;
+
+    pthread_mutex_lock(&links_lock);
+    if ((l = free_link()) != NULL)
+    {
+        l->db_fd = db_fd;
+        l->map = map;
+        l->len = st.st_size;
+        l->nbits = h.nbits;
+        l->nhash = h.nhash;
+        l->dev = st.st_dev;
+        l->ino = st.st_ino;
+        snprintf(l->db_file, sizeof(l->db_file), "%s", dbFile);
+    }
+    pthread_mutex_unlock(&links_lock);
+    if (l == NULL)
+    {
+        munmap(map, st.st_size);
+        return SRCH_NOT_FOUND;
+    }
+    return NO_ERROR;
+}
+
+void bloom_detach(int db_fd)
+{
+    bloom_link_t *l = find_link(db_fd);
+
+    if (l != NULL)
+    {
+        munmap(l->map, l->len);
+        pthread_mutex_lock(&links_lock);
+        l->db_fd = -1;
+        pthread_mutex_unlock(&links_lock);
+    }
+}
+
+/*
+ *  current_link
+ *
+ *  The filter attached to db_fd, switched over to the new file first if
+ *  another process rebuilt the filter since it was mapped.  Otherwise bits
+ *  set in the old, renamed over, file would be lost.
+ */
+static bloom_link_t *current_link(int db_fd)
+{
+    bloom_link_t *l = find_link(db_fd);
+    char path[PATH_BUF_SZ];
+    char db_file[PATH_BUF_SZ];
+    struct stat st;
+
+    if (l == NULL)
+        return NULL;
+
+    filter_path(l->db_file, path, sizeof(path));
+    if (stat(path, &st) == 0 && st.st_dev == l->dev && st.st_ino == l->ino)
+        return l;
+
+    snprintf(db_file, sizeof(db_file), "%s", l->db_file);
+    bloom_detach(db_fd);
+    bloom_attach(db_fd, db_file);
+    return find_link(db_fd);
+}
+
+//sets the bits of one name in a bit array
+static void set_bits(uint8_t *bits, uint32_t nbits, uint32_t nhash, const student_t *s)
+{
+    bloom_key_t k = name_key(s->fname, s->lname);
+
+    for (uint32_t i = 0; i < nhash; i++)
+    {
+        uint32_t b = bloom_bit(k, i, nbits);
+        __atomic_fetch_or(&bits[b / 8], (uint8_t)(1u << (b % 8)), __ATOMIC_RELAXED);
+    }
+}
+
+//scan_db() callback for bloom_rebuild(), ctx is the bit array
+static int rebuild_one(const student_t *s, void *ctx)
+{
+    set_bits(ctx, BLOOM_BITS, BLOOM_HASHES, s);
+    return NO_ERROR;
+}
+
+/*
+ *  bloom_rebuild
+ *      db_fd:   fd of an open database file
+ *      dbFile:  name of that database file
+ *
+ *  Builds a fresh name filter from a full scan of db_fd, renames it into
+ *  place and attaches it.  The caller holds the change log lock (see
+ *  log_begin()) so no student is added behind the scan's back.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int bloom_rebuild(int db_fd, const char *dbFile)
+{
+    char path[PATH_BUF_SZ];
+    char tmp[PATH_BUF_SZ];
+    size_t len = sizeof(bloom_hdr_t) + BLOOM_BITS / 8;
+    bloom_hdr_t *h;
+    uint8_t *buff;
+    int fd;
+    int rc;
+
+    if ((buff = calloc(1, len)) == NULL)
+        return ERR_DB_FILE;
+
+    h = (bloom_hdr_t *)buff;
+    memcpy(h->magic, BLOOM_MAGIC, sizeof(h->magic));
+    h->version = BLOOM_VERSION;
+    h->nbits = BLOOM_BITS;
+    h->nhash = BLOOM_HASHES;
+
+    rc = scan_db(db_fd, rebuild_one, buff + sizeof(bloom_hdr_t));
+
+    filter_path(dbFile, path, sizeof(path));
+    tmp_db_path(path, tmp, sizeof(tmp));
+    if (rc == NO_ERROR)
+    {
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (fd < 0 || write(fd, buff, len) != (ssize_t)len)
+            rc = ERR_DB_FILE;
+        if (fd >= 0 && close(fd) != 0)
+            rc = ERR_DB_FILE;
+        if (rc == NO_ERROR && rename(tmp, path) == -1)
+            rc = ERR_DB_FILE;
+        if (rc != NO_ERROR)
+            unlink(tmp);
+    }
+    free(buff);
+
+    bloom_detach(db_fd);
+    if (rc == NO_ERROR && bloom_attach(db_fd, dbFile) != NO_ERROR)
+        rc = ERR_DB_FILE;
+    return rc;
+}
+
+//add_student() hook, records the name of a new student.  Called with the
+//change log lock held, so if db_fd had no filter when it was opened and
+//another process has built one since, it is attached here first, a name
+//missing from it would be a false negative.
+void bloom_add(int db_fd, const student_t *s)
+{
+    bloom_link_t *l = current_link(db_fd);
+    const char *dbFile;
+
+    if (l == NULL && (dbFile = log_db_file(db_fd)) != NULL &&
+        bloom_attach(db_fd, dbFile) == NO_ERROR)
+        l = find_link(db_fd);
+
+    if (l != NULL)
+        set_bits(l->map + sizeof(bloom_hdr_t), l->nbits, l->nhash, s);
+}
+
+/*
+ *  bloom_may_contain
+ *
+ *  returns:  false if db_fd has a filter and the name is definitely not in
+ *            the database, true otherwise
+ */
+bool bloom_may_contain(int db_fd, const char *fname, const char *lname)
+{
+    bloom_link_t *l = current_link(db_fd);
+    bloom_key_t k = name_key(fname, lname);
+    const uint8_t *bits;
+
+    if (l == NULL)
+        return true;
+
+    bits = l->map + sizeof(bloom_hdr_t);
+    for (uint32_t i = 0; i < l->nhash; i++)
+    {
+        uint32_t b = bloom_bit(k, i, l->nbits);
+        if ((__atomic_load_n(&bits[b / 8], __ATOMIC_RELAXED) & (1u << (b % 8))) == 0)
+            return false;
+    }
+    return true;
+}
+
+//what find_by_name() is looking for, and how many it found
+typedef struct name_query
+{
+    const char *fname;
+    const char *lname;
+    int *printed;
+    int found;
+} name_query_t;
+
+static int match_name(const student_t *s, void *ctx)
+{
+    name_query_t *q = ctx;
+
+    if (strncmp(s->fname, q->fname, sizeof(s->fname) - 1) != 0 ||
+        strncmp(s->lname, q->lname, sizeof(s->lname) - 1) != 0)
+        return NO_ERROR;
+
+    if (q->printed != NULL)
+    {
+        if ((*q->printed)++ == 0)
+            printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST NAME", "GPA");
+        printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0);
+    }
+    q->found++;
+    return NO_ERROR;
+}
+
+/*
+ *  find_by_name
+ *      db_fd:   fd of an open database file
+ *      dbFile:  name of that database file
+ *      fname:   first name to look for
+ *      lname:   last name to look for
+ *      printed: NULL to only count the students found, otherwise they are
+ *               printed in the -f format and *printed counts the rows
+ *               printed so far (the header goes before the first one)
+ *
+ *  Finds the students named fname lname.  The name filter is consulted
+ *  first, built if the database does not have one yet, and the database
+ *  is only scanned if the filter says the name may be in it.
+ *
+ *  returns:  the number of students found, or ERR_DB_FILE
+ *
+ *  console:  with printed, the students found.  M_ERR_BLOOM if the filter
+ *            could not be built
+ */
+int find_by_name(int db_fd, const char *dbFile, const char *fname, const char *lname,
+                 int *printed)
+{
+    name_query_t q = {fname, lname, printed, 0};
+    int rc;
+
+    if (find_link(db_fd) == NULL && bloom_attach(db_fd, dbFile) != NO_ERROR)
+    {
+        rc = log_begin(db_fd);
+        if (rc == NO_ERROR)
+            rc = bloom_rebuild(db_fd, dbFile);
+        log_end(db_fd);
+        if (rc != NO_ERROR)
+        {
+            printf(M_ERR_BLOOM, dbFile);
+            return ERR_DB_FILE;
+        }
+    }
+
+    if (!bloom_may_contain(db_fd, fname, lname))
+        return 0;
+
+    rc = scan_db(db_fd, match_name, &q);
+    return (rc == NO_ERROR) ? q.found : ERR_DB_FILE;
+}
@@ -0,0 +1,48 @@
+#ifndef __SDB_BLOOM_H__
+    #define __SDB_BLOOM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+
+//Name filter.  A Bloom filter over the first and last names of the students
+//in a database file is kept next to it (student.db -> student.db.bloom).
+//add_student() sets the bits of every new name, so a filter answer of "not
+//present" is final and name lookups (-n) and duplicate name checks (-a
+//--unique) only scan the database when the filter says the name may be
+//there.  Deleting a student leaves its bits set, that only costs a scan;
+//compressing (-x) and zeroing (-z) the database rebuild the filter.
+//
+//A database without a filter file gets one built by a full scan the first
+//time a name is looked up.  Removing the file is always safe, it just
+//forces that rebuild.
+#define BLOOM_FILE_SUFFIX   ".bloom"
+#define BLOOM_MAGIC         "SDBBLM01"
+#define BLOOM_VERSION       1
+#define BLOOM_BITS          (1u << 20)  //128 KiB, ~0.7% false positives at 100000 names
+#define BLOOM_HASHES        7
+
+typedef struct bloom_hdr
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nbits;         //a power of two
+    uint32_t nhash;
+    uint32_t pad[11];       //header is 64 bytes, the bit array follows
+} bloom_hdr_t;
+
+#define M_STD_NAME_NOT_FND  "No student named %s %s in database.\n"
+#define M_ERR_DB_ADD_NAME   "Cant add student %s %s, the name already exists in db.\n"
+#define M_ERR_BLOOM         "Error building name filter for %s, exiting!\n"
+
+//prototypes for sdb_bloom.c
+int bloom_attach(int db_fd, const char *dbFile);
+void bloom_detach(int db_fd);
+int bloom_rebuild(int db_fd, const char *dbFile);
+void bloom_add(int db_fd, const student_t *s);
+bool bloom_may_contain(int db_fd, const char *fname, const char *lname);
+int find_by_name(int db_fd, const char *dbFile, const char *fname, const char *lname,
+                 int *printed);
+
+#endif
@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_cache.h"
+#include "sdb_log.h"
+#include "sdb_shard.h"
+
+//one cached page.  Pages are chained off the hash buckets by slot index.
+//The fields are only changed under the cache lock, inside a write section of
+//the page (see write_begin()), and are read without the lock by
+//read_page().
+typedef struct cache_page
+{
+    int fd;             //-1 if the slot is free
+    off_t page_no;
+    bool ref;           //CLOCK reference bit
+    int next;           //next slot in the same bucket, -1 ends the chain
+} cache_page_t;
+
+//the change log position the cached pages of fd are current with, see
+//sync_log().  The log fd is kept here so a lookup does not go through the
+//link table of sdb_log.c and its lock.
+typedef struct cache_log
+{
+    int fd;
+    int log_fd;         //-1 if fd has no change log
+    unsigned long long seq;
+} cache_log_t;
+
+typedef struct page_cache
+{
+    int n_pages;
+    int n_used;
+    int hand;           //CLOCK hand
+    int n_buckets;
+    int *buckets;
+    cache_page_t *pages;
+    char *data;         //n_pages * CACHE_PAGE_SZ bytes
+    unsigned *seq;      //per page sequence counters, odd while a writer is in the page
+    cache_log_t logs[SHARD_MAX + 1];    //added to under the lock, read without
+    int n_logs;
+    pthread_mutex_t lock;   //serializes writers and misses
+    unsigned long hits;
+    unsigned long misses;
+} page_cache_t;
+
+static page_cache_t cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int bucket_of(int fd, off_t page_no)
+{
+    unsigned long h = (unsigned long)page_no * 2654435761u + (unsigned long)fd * 40503u;
+    return h % cache.n_buckets;
+}
+
+static char *page_data(int slot)
+{
+    return cache.data + (size_t)slot * CACHE_PAGE_SZ;
+}
+
+//seqlock writer side, the caller holds the cache lock.  Readers that see an
+//odd count, or a count that changed while they copied, retry.
+static void write_begin(int slot)
+{
+    __atomic_store_n(&cache.seq[slot], cache.seq[slot] + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(int slot)
+{
+    __atomic_store_n(&cache.seq[slot], cache.seq[slot] + 1, __ATOMIC_RELEASE);
+}
+
+//caller holds the cache lock
+static int find_page(int fd, off_t page_no)
+{
+    for (int i = cache.buckets[bucket_of(fd, page_no)]; i >= 0; i = cache.pages[i].next)
+        if (cache.pages[i].fd == fd && cache.pages[i].page_no == page_no)
+            return i;
+    return -1;
+}
+
+//caller holds the cache lock and is in a write section of slot
+static void unlink_page(int slot)
+{
+    cache_page_t *p = &cache.pages[slot];
+    int *link = &cache.buckets[bucket_of(p->fd, p->page_no)];
+
+    while (*link != slot)
+        link = &cache.pages[*link].next;
+    __atomic_store_n(link, p->next, __ATOMIC_RELEASE);
+    __atomic_store_n(&p->fd, -1, __ATOMIC_RELAXED);
+    cache.n_used--;
+}
+
+//picks the slot for a new page, evicting the first page the CLOCK hand
+//finds with its reference bit clear.  The caller holds the cache lock.
+static int victim_page(void)
+{
+    for (;;)
+    {
+        int slot = cache.hand;
+        cache_page_t *p = &cache.pages[slot];
+
+        cache.hand = (cache.hand + 1) % cache.n_pages;
+        if (p->fd < 0)
+            return slot;
+        if (!__atomic_load_n(&p->ref, __ATOMIC_RELAXED))
+        {
+            write_begin(slot);
+            unlink_page(slot);
+            write_end(slot);
+            return slot;
+        }
+        __atomic_store_n(&p->ref, false, __ATOMIC_RELAXED);
+    }
+}
+
+//caller holds the cache lock
+static void drop_pages(int fd)
+{
+    for (int i = 0; i < cache.n_pages; i++)
+    {
+        if (cache.pages[i].fd == fd)
+        {
+            write_begin(i);
+            unlink_page(i);
+            write_end(i);
+        }
+    }
+}
+
+static cache_log_t *find_log(int fd)
+{
+    int n = __atomic_load_n(&cache.n_logs, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < n; i++)
+        if (cache.logs[i].fd == fd)
+            return &cache.logs[i];
+    return NULL;
+}
+
+//caller holds the cache lock.  Returns NULL if no more fds can be tracked,
+//the pages of such an fd are dropped on every lookup.
+static cache_log_t *add_log(int fd)
+{
+    cache_log_t *l;
+
+    if (cache.n_logs == (int)(sizeof(cache.logs) / sizeof(cache.logs[0])))
+        return NULL;
+    l = &cache.logs[cache.n_logs];
+    l->fd = fd;
+    l->log_fd = log_fd(fd);
+    l->seq = log_fd_seq(l->log_fd);
+    __atomic_store_n(&cache.n_logs, cache.n_logs + 1, __ATOMIC_RELEASE);
+    return l;
+}
+
+/*
+ *  sync_log
+ *      fd:   database about to be looked up in
+ *      own:  the caller holds the change log lock and just logged one change
+ *            of its own, that it is putting in the cache
+ *
+ *  Drops the cached pages of fd if the change log of fd moved on since they
+ *  were read, that is, if another process changed the file.  Writers change
+ *  the file before they log, so once the log position is recorded every
+ *  page read after it holds at least those changes, and any later change
+ *  moves the log again.  Once fd is in the log table this takes no lock
+ *  unless the log moved.  Lookups only call it for an fd they have not seen
+ *  yet, after that it runs from cache_sync() and cache_put().
+ */
+static void sync_log(int fd, bool own)
+{
+    cache_log_t *l = find_log(fd);
+    unsigned long long seq;
+
+    if (l != NULL)
+    {
+        seq = log_fd_seq(l->log_fd);
+        if (__atomic_load_n(&l->seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+    if ((l = find_log(fd)) == NULL)
+    {
+        // nothing of fd is cached before its first lookup
+        if (add_log(fd) == NULL)
+            drop_pages(fd);
+    }
+    else if (l->seq != (seq = log_fd_seq(l->log_fd)))
+    {
+        if (!own || l->seq + 1 != seq)
+            drop_pages(fd);
+        __atomic_store_n(&l->seq, seq, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/*
+ *  read_page
+ *      fd:       database file
+ *      page_no:  page of fd to look for
+ *      offset:   offset of the slot in the page
+ *      *s:       filled in with a copy of the slot
+ *
+ *  Lock free lookup, the seqlock reader side.  The bucket chain is walked
+ *  and the slot copied without the cache lock; the copy is only kept if the
+ *  page's sequence count was even and unchanged around it, otherwise a
+ *  writer was in the page and the lookup starts over.  A writer relinking
+ *  pages can send the walk down the wrong chain, that just reads as a miss
+ *  and cache_get() looks again under the lock.
+ *
+ *  returns:  true if the page is cached and *s holds a consistent copy
+ */
+static bool read_page(int fd, off_t page_no, off_t offset, student_t *s)
+{
+    for (;;)
+    {
+        int i = __atomic_load_n(&cache.buckets[bucket_of(fd, page_no)], __ATOMIC_ACQUIRE);
+        int steps = cache.n_pages;
+        bool retry = false;
+
+        while (i >= 0 && steps-- > 0)
+        {
+            cache_page_t *p = &cache.pages[i];
+            unsigned seq = __atomic_load_n(&cache.seq[i], __ATOMIC_ACQUIRE);
+
+            if (seq & 1)
+            {
+                retry = true;
+                break;
+            }
+            if (__atomic_load_n(&p->fd, __ATOMIC_RELAXED) == fd &&
+                __atomic_load_n(&p->page_no, __ATOMIC_RELAXED) == page_no)
+            {
+                memcpy(s, page_data(i) + offset, sizeof(student_t));
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&cache.seq[i], __ATOMIC_RELAXED) != seq)
+                {
+                    retry = true;
+                    break;
+                }
+                __atomic_store_n(&p->ref, true, __ATOMIC_RELAXED);
+                return true;
+            }
+            i = __atomic_load_n(&p->next, __ATOMIC_ACQUIRE);
+        }
+        if (!retry)
+            return false;
+    }
+}
+
+/*
+ *  cache_init
+ *      budget_kb:  memory for cached pages, in KiB
+ *
+ *  Turns the slot read cache on, see sdb_cache.h.  Not safe to call while
+ *  other threads use the cache.
+ *
+ *  returns:  NO_ERROR or ERR_DB_OP if the memory is not available
+ *
+ *  console:  Does not produce any console I/O
+ */
+int cache_init(int budget_kb)
+{
+    if (budget_kb < CACHE_MIN_KB)
+        budget_kb = CACHE_MIN_KB;
+
+    cache_free();
+    cache.n_pages = (int)(((long)budget_kb * 1024) / CACHE_PAGE_SZ);
+    cache.n_buckets = cache.n_pages * 2;
+    cache.buckets = malloc(cache.n_buckets * sizeof(int));
+    cache.pages = malloc(cache.n_pages * sizeof(cache_page_t));
+    cache.data = malloc((size_t)cache.n_pages * CACHE_PAGE_SZ);
+    cache.seq = calloc(cache.n_pages, sizeof(unsigned));
+    if (cache.buckets == NULL || cache.pages == NULL || cache.data == NULL ||
+        cache.seq == NULL)
+    {
+        cache_free();
+        return ERR_DB_OP;
+    }
+
+    for (int i = 0; i < cache.n_buckets; i++)
+        cache.buckets[i] = -1;
+    for (int i = 0; i < cache.n_pages; i++)
+        cache.pages[i].fd = -1;
+    return NO_ERROR;
+}
+
+void cache_free(void)
+{
+    free(cache.buckets);
+    free(cache.pages);
+    free(cache.data);
+    free(cache.seq);
+    cache.buckets = NULL;
+    cache.pages = NULL;
+    cache.data = NULL;
+    cache.seq = NULL;
+    cache.n_pages = cache.n_used = cache.n_buckets = cache.hand = 0;
+    cache.n_logs = 0;
+    cache.hits = cache.misses = 0;
+}
+
+bool cache_active(void)
+{
+    return cache.n_pages > 0;
+}
+
+/*
+ *  cache_get
+ *      fd:  linux file descriptor of a slot format database
+ *      id:  student to look up
+ *      *s:  filled in with the student if found
+ *
+ *  Looks the slot of id up in the cached page, reading the page from fd on
+ *  a miss.  Changes other processes made are picked up by cache_sync(), a
+ *  hit makes no system call.  The part of a page past the end of the file
+ *  reads as empty slots.  Hits take no lock, see read_page(); misses are
+ *  serialized on the cache lock.
+ *
+ *  returns:  NO_ERROR, SRCH_NOT_FOUND or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int cache_get(int fd, int id, student_t *s)
+{
+    off_t offset = (off_t)id * sizeof(student_t);
+    off_t page_no = offset / CACHE_PAGE_SZ;
+    student_t slot;
+    int rc = NO_ERROR;
+    int i;
+
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return SRCH_NOT_FOUND;
+
+    if (find_log(fd) == NULL)
+        sync_log(fd, false);
+    if (read_page(fd, page_no, offset % CACHE_PAGE_SZ, &slot))
+    {
+        __atomic_fetch_add(&cache.hits, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        pthread_mutex_lock(&cache.lock);
+
+        // another thread may have brought the page in since read_page()
+        i = find_page(fd, page_no);
+        if (i >= 0)
+        {
+            __atomic_fetch_add(&cache.hits, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            __atomic_fetch_add(&cache.misses, 1, __ATOMIC_RELAXED);
+            i = victim_page();
+
+            // the victim is unlinked, readers can no longer match it
+            ssize_t n = pread(fd, page_data(i), CACHE_PAGE_SZ, page_no * CACHE_PAGE_SZ);
+            if (n < 0)
+                rc = ERR_DB_FILE;
+            else
+            {
+                memset(page_data(i) + n, 0, CACHE_PAGE_SZ - n);
+
+                int b = bucket_of(fd, page_no);
+                write_begin(i);
+                __atomic_store_n(&cache.pages[i].fd, fd, __ATOMIC_RELAXED);
+                __atomic_store_n(&cache.pages[i].page_no, page_no, __ATOMIC_RELAXED);
+                __atomic_store_n(&cache.pages[i].next, cache.buckets[b], __ATOMIC_RELAXED);
+                write_end(i);
+                __atomic_store_n(&cache.buckets[b], i, __ATOMIC_RELEASE);
+                cache.n_used++;
+            }
+        }
+        if (rc == NO_ERROR)
+        {
+            __atomic_store_n(&cache.pages[i].ref, true, __ATOMIC_RELAXED);
+            memcpy(&slot, page_data(i) + offset % CACHE_PAGE_SZ, sizeof(student_t));
+        }
+        pthread_mutex_unlock(&cache.lock);
+        if (rc != NO_ERROR)
+            return rc;
+    }
+
+    if (slot.id != id)
+        return SRCH_NOT_FOUND;
+    memcpy(s, &slot, sizeof(student_t));
+    return NO_ERROR;
+}
+
+/*
+ *  cache_put
+ *      fd:  database the slot of id was just written to
+ *      id:  student id
+ *      *s:  the new contents of the slot
+ *
+ *  Write-through hook for add_student() and del_student(): brings the
+ *  cached copy of the page, if there is one, up to date.  Readers of the
+ *  page never see half of the new record, see read_page().  Called after
+ *  the change was logged, with the change log lock still held, so only
+ *  this change is new in the log unless another process wrote before the
+ *  lock was taken; then the pages of fd are dropped instead.
+ */
+void cache_put(int fd, int id, const student_t *s)
+{
+    off_t offset = (off_t)id * sizeof(student_t);
+    int i;
+
+    if (!cache_active())
+        return;
+
+    sync_log(fd, true);
+    pthread_mutex_lock(&cache.lock);
+    if ((i = find_page(fd, offset / CACHE_PAGE_SZ)) >= 0)
+    {
+        write_begin(i);
+        memcpy(page_data(i) + offset % CACHE_PAGE_SZ, s, sizeof(student_t));
+        write_end(i);
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/*
+ *  cache_sync
+ *
+ *  Drops the cached pages of every file another process changed since the
+ *  last call, see sync_log().  Costs one fstat() of each change log, the
+ *  session runs it once per command so what a command reads is never older
+ *  than the command.
+ *
+ *  console:  Does not produce any console I/O
+ */
+void cache_sync(void)
+{
+    int n = __atomic_load_n(&cache.n_logs, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < n; i++)
+        sync_log(cache.logs[i].fd, false);
+}
+
+void cache_stats(void)
+{
+    printf(M_CACHE_STATS, __atomic_load_n(&cache.hits, __ATOMIC_RELAXED),
+           __atomic_load_n(&cache.misses, __ATOMIC_RELAXED), cache.n_used, cache.n_pages);
+}
@@ -0,0 +1,44 @@
+#ifndef __SDB_CACHE_H__
+    #define __SDB_CACHE_H__
+
+#include <stdbool.h>
+
+#include "db.h"
+
+//Slot read cache.  Long running sdbsc processes (session mode, -i) keep
+//recently read CACHE_PAGE_SZ pages of the database files in memory, so
+//repeated get_student() calls for hot ids never reach the kernel.  Pages
+//are evicted with the CLOCK algorithm.  add_student() and del_student()
+//write through: the file is written first, then the cached copy of the
+//page (if any) is updated.
+//
+//The cache can be shared by the threads of a process.  Lookups of cached
+//pages take no lock: every page has a sequence count in a side array that a
+//writer makes odd while it changes the page, and readers copy the 64 byte
+//slot optimistically and retry if the count moved (a seqlock).  Readers
+//never block writers or each other and never see a torn record.  Misses,
+//cache_put() and the page drops of sync_log() are serialized on one lock.
+//cache_init() and cache_free() must not race with anything.
+//
+//Writes made by other sdbsc processes show up as new records in the change
+//log (see sdb_log.h).  cache_sync() compares the log position with the one
+//the cached pages of each file were read at and drops them if it moved.
+//The session calls it once per command, so a hit makes no system call and
+//never returns a record older than the command it was read for.
+#define CACHE_PAGE_SZ       4096
+#define CACHE_PAGE_SLOTS    (CACHE_PAGE_SZ / (int)sizeof(student_t))
+#define CACHE_DEF_KB        256     //default budget, 64 pages
+#define CACHE_MIN_KB        4
+
+#define M_CACHE_STATS       "Cache: %lu hit(s), %lu miss(es), %d of %d page(s) used.\n"
+
+//prototypes for sdb_cache.c
+int cache_init(int budget_kb);
+void cache_free(void);
+bool cache_active(void);
+int cache_get(int fd, int id, student_t *s);
+void cache_put(int fd, int id, const student_t *s);
+void cache_sync(void);
+void cache_stats(void);
+
+#endif
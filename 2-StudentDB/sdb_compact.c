@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_compact.h"
+#include "sdb_log.h"
+
+_Static_assert(sizeof(compact_hdr_t) == 64, "compact header must fill slot 0");
+
+/*
+ *  read_hdr
+ *
+ *  returns:  true if fd is a compact database, its header is copied to *h
+ */
+static bool read_hdr(int fd, compact_hdr_t *h)
+{
+    if (pread(fd, h, sizeof(*h), 0) != sizeof(*h))
+        return false;
+    return memcmp(h->magic, COMPACT_MAGIC, sizeof(h->magic)) == 0;
+}
+
+/*
+ *  db_is_compact
+ *      fd:  linux file descriptor
+ *
+ *  The header is read once per fd with a change log attached, after that
+ *  the slot format is remembered with the log link (see log_slot_known()),
+ *  so adds, deletes and lookups do not pay for a second read.
+ *
+ *  returns:  true if the database is in the compact format, false if it
+ *            uses the regular 64 byte slot format (or is empty)
+ */
+bool db_is_compact(int fd)
+{
+    compact_hdr_t h;
+
+    if (log_slot_known(fd))
+        return false;
+    if (read_hdr(fd, &h))
+        return true;
+    log_slot_note(fd, true);
+    return false;
+}
+
+/*
+ *  compact_info
+ *      fd:  linux file descriptor
+ *      *h:  where the header is copied
+ *
+ *  Record count and id bounds of a compact database, for the query planner.
+ *
+ *  returns:  true if fd is a compact database
+ */
+bool compact_info(int fd, compact_hdr_t *h)
+{
+    return read_hdr(fd, h);
+}
+
+/*
+ *  encode_rec / decode_rec
+ *
+ *  Convert between a student_t and the compact record encoding described
+ *  in sdb_compact.h.  decode_rec() returns the number of bytes consumed,
+ *  0 if avail does not hold a complete record yet, or ERR_DB_FILE if the
+ *  record is corrupt.
+ */
+static size_t encode_rec(uint8_t *p, const student_t *s, int prev_id)
+{
+    uint8_t *start = p;
+    uint32_t delta = (uint32_t)(s->id - prev_id);
+    size_t flen = strnlen(s->fname, sizeof(s->fname) - 1);
+    size_t llen = strnlen(s->lname, sizeof(s->lname) - 1);
+
+    do
+    {
+        uint8_t b = delta & 0x7f;
+        delta >>= 7;
+        *p++ = b | (delta ? 0x80 : 0);
+    } while (delta);
+
+    *p++ = (uint8_t)flen;
+    memcpy(p, s->fname, flen);
+    p += flen;
+    *p++ = (uint8_t)llen;
+    memcpy(p, s->lname, llen);
+    p += llen;
+    *p++ = s->gpa & 0xff;
+    *p++ = (s->gpa >> 8) & 0xff;
+
+    return p - start;
+}
+
+static int decode_rec(const uint8_t *p, size_t avail, int prev_id, student_t *s)
+{
+    size_t pos = 0;
+    uint32_t delta = 0;
+    int shift = 0;
+    uint8_t b;
+
+    do
+    {
+        if (pos == avail)
+            return 0;
+        if (shift > 28)
+            return ERR_DB_FILE;
+        b = p[pos++];
+        delta |= (uint32_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    memset(s, 0, sizeof(*s));
+    s->id = prev_id + (int)delta;
+
+    if (pos == avail)
+        return 0;
+    size_t flen = p[pos++];
+    if (flen >= sizeof(s->fname))
+        return ERR_DB_FILE;
+    if (pos + flen + 1 > avail)
+        return 0;
+    memcpy(s->fname, p + pos, flen);
+    pos += flen;
+
+    size_t llen = p[pos++];
+    if (llen >= sizeof(s->lname))
+        return ERR_DB_FILE;
+    if (pos + llen + 2 > avail)
+        return 0;
+    memcpy(s->lname, p + pos, llen);
+    pos += llen;
+
+    s->gpa = p[pos] | (p[pos + 1] << 8);
+    pos += 2;
+
+    return (int)pos;
+}
+
+/*
+ *  compact_get
+ *      fd:  linux file descriptor of a compact database
+ *      id:  the student id we are looking for
+ *      *s:  where the student is copied if found
+ *
+ *  O(1) lookup: one read of the directory entry for id and one read of the
+ *  record it points at.
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ */
+int compact_get(int fd, int id, student_t *s)
+{
+    compact_hdr_t h;
+    uint32_t entry;
+    uint8_t rec[COMPACT_MAX_REC];
+    ssize_t bytes;
+
+    if (!read_hdr(fd, &h))
+        return ERR_DB_FILE;
+    if (h.count == 0 || id < (int)h.min_id || id > (int)h.max_id)
+        return SRCH_NOT_FOUND;
+
+    off_t dir_pos = h.dir_off + (off_t)(id - h.min_id) * sizeof(entry);
+    if (pread(fd, &entry, sizeof(entry), dir_pos) != sizeof(entry))
+        return ERR_DB_FILE;
+    if (entry == 0)
+        return SRCH_NOT_FOUND;
+
+    bytes = pread(fd, rec, sizeof(rec), h.data_off + entry - 1);
+    if (bytes <= 0)
+        return ERR_DB_FILE;
+
+    // the id in the record is a delta from its neighbour, the directory
+    // already told us which id it is
+    if (decode_rec(rec, bytes, 0, s) <= 0)
+        return ERR_DB_FILE;
+    s->id = id;
+
+    return NO_ERROR;
+}
+
+/*
+ *  compact_scan
+ *      fd:   linux file descriptor of a compact database
+ *      fn:   callback invoked for every live student record
+ *      ctx:  passed through to fn
+ *
+ *  The compact equivalent of scan_db().  Only the data area is read, in
+ *  SCAN_BLOCK_SZ chunks, and a record that straddles two chunks is carried
+ *  over to the next one.
+ *
+ *  returns:  same as scan_db()
+ */
+int compact_scan(int fd, scan_fn fn, void *ctx)
+{
+    compact_hdr_t h;
+    uint8_t *buf;
+    size_t have = 0;
+    uint64_t done = 0;
+    int prev_id = 0;
+    int rc = NO_ERROR;
+
+    if (!read_hdr(fd, &h))
+        return ERR_DB_FILE;
+
+    buf = malloc(SCAN_BLOCK_SZ + COMPACT_MAX_REC);
+    if (buf == NULL)
+        return ERR_DB_FILE;
+
+    while (rc == NO_ERROR && done < h.data_len)
+    {
+        size_t want = SCAN_BLOCK_SZ;
+        if (want > h.data_len - done)
+            want = h.data_len - done;
+
+        ssize_t bytes = pread(fd, buf + have, want, h.data_off + done);
+        if (bytes <= 0)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        done += bytes;
+        have += bytes;
+
+        size_t pos = 0;
+        while (rc == NO_ERROR && pos < have)
+        {
+            student_t s;
+            int used = decode_rec(buf + pos, have - pos, prev_id, &s);
+
+            if (used < 0 || (used == 0 && done == h.data_len))
+                rc = ERR_DB_FILE;
+            if (used <= 0)
+                break;
+
+            pos += used;
+            prev_id = s.id;
+            rc = fn(&s, ctx);
+        }
+
+        // keep the partial record for the next block
+        memmove(buf, buf + pos, have - pos);
+        have -= pos;
+    }
+
+    free(buf);
+    return rc;
+}
+
+/*
+ *  Builder state for compact_db().  Records arrive from scan_db() in id
+ *  order and are appended to data, dir is indexed by id.
+ */
+typedef struct compact_build
+{
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    uint32_t *dir;
+    int count;
+    int min_id;
+    int max_id;
+} compact_build_t;
+
+static int compact_add(const student_t *s, void *ctx)
+{
+    compact_build_t *b = ctx;
+
+    if (s->id < MIN_STD_ID || s->id > MAX_STD_ID)
+        return ERR_DB_FILE;
+
+    if (b->len + COMPACT_MAX_REC > b->cap)
+    {
+        size_t cap = b->cap ? b->cap * 2 : SCAN_BLOCK_SZ;
+        uint8_t *data = realloc(b->data, cap);
+        if (data == NULL)
+            return ERR_DB_FILE;
+        b->data = data;
+        b->cap = cap;
+    }
+
+    if (b->count == 0)
+        b->min_id = s->id;
+    b->dir[s->id] = (uint32_t)b->len + 1;
+    b->len += encode_rec(b->data + b->len, s, b->max_id);
+    b->max_id = s->id;
+    b->count++;
+
+    return NO_ERROR;
+}
+
+//pwrite() all of len bytes or fail
+static int write_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    const char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  replace_db
+ *
+ *  Makes the finished temporary file tmp_fd/tmp the database: fsync it,
+ *  rename it over dbFile and move it onto the caller's fd number, like
+ *  compress_db(), so the change log and name filter stay attached.
+ */
+static int replace_db(int fd, int tmp_fd, char *tmp, char *dbFile)
+{
+    if (fsync(tmp_fd) == -1 || rename(tmp, dbFile) == -1)
+    {
+        close(tmp_fd);
+        unlink(tmp);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    if (dup2(tmp_fd, fd) == -1)
+        return tmp_fd;
+    close(tmp_fd);
+
+    // the format changed, db_is_compact() reads the header again
+    log_slot_note(fd, false);
+    return fd;
+}
+
+/*
+ *  compact_db
+ *      fd:      linux file descriptor of a slot format database
+ *      dbFile:  name of the database file
+ *
+ *  Rewrites the database in the compact format (see sdb_compact.h) in a
+ *  temporary file next to dbFile and renames it into place.  The caller
+ *  holds the change log lock (see log_begin()), so no add or delete lands
+ *  in the old file after it was read.
+ *
+ *  returns:  <number>       the fd of the compact database
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_COMPACT_OK  on success
+ *            M_ERR_DB_READ    error reading the database
+ *            M_ERR_DB_WRITE   error writing the temporary file
+ *            M_ERR_DB_CREATE  error renaming it into place
+ */
+int compact_db(int fd, char *dbFile)
+{
+    compact_build_t b = {0};
+    compact_hdr_t h = {0};
+    char tmp[PATH_BUF_SZ];
+    int tmp_fd;
+    int rc;
+
+    if (db_is_compact(fd))
+    {
+        read_hdr(fd, &h);
+        printf(M_DB_COMPACT_OK, (int)h.count, (long)lseek(fd, 0, SEEK_END));
+        return fd;
+    }
+
+    b.dir = calloc(MAX_STD_ID + 1, sizeof(uint32_t));
+    if (b.dir == NULL)
+        return ERR_DB_FILE;
+
+    rc = scan_db(fd, compact_add, &b);
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        goto fail;
+    }
+
+    memcpy(h.magic, COMPACT_MAGIC, sizeof(h.magic));
+    h.version = COMPACT_VERSION;
+    h.count = b.count;
+    h.min_id = b.count ? b.min_id : 0;
+    h.max_id = b.count ? b.max_id : 0;
+    h.dir_off = sizeof(h);
+    h.data_off = h.dir_off + (b.count ? (h.max_id - h.min_id + 1) * sizeof(uint32_t) : 0);
+    h.data_len = b.len;
+
+    tmp_db_path(dbFile, tmp, sizeof(tmp));
+    tmp_fd = open_db(tmp, true);
+    if (tmp_fd < 0)
+    {
+        rc = ERR_DB_FILE;
+        goto fail;
+    }
+
+    if (write_all(tmp_fd, &h, sizeof(h), 0) != NO_ERROR ||
+        write_all(tmp_fd, b.dir + h.min_id, h.data_off - h.dir_off, h.dir_off) != NO_ERROR ||
+        write_all(tmp_fd, b.data, b.len, h.data_off) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        close(tmp_fd);
+        unlink(tmp);
+        rc = ERR_DB_FILE;
+        goto fail;
+    }
+
+    rc = replace_db(fd, tmp_fd, tmp, dbFile);
+    if (rc >= 0)
+        printf(M_DB_COMPACT_OK, b.count, (long)(h.data_off + h.data_len));
+
+fail:
+    free(b.dir);
+    free(b.data);
+    return rc;
+}
+
+//compact_scan() callback for expand_db(), writes a record to its slot
+static int expand_one(const student_t *s, void *ctx)
+{
+    int *tmp_fd = ctx;
+
+    return write_all(*tmp_fd, s, sizeof(student_t), (off_t)s->id * sizeof(student_t));
+}
+
+/*
+ *  expand_db
+ *      fd:      linux file descriptor of a compact database
+ *      dbFile:  name of the database file
+ *
+ *  Converts a compact database back to the regular slot format so it can
+ *  be modified again.  Like compact_db() it runs under the change log lock.
+ *
+ *  returns:  <number>       the fd of the expanded database
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_EXPAND_OK   on success
+ *            M_ERR_DB_WRITE   error writing the temporary file
+ *            M_ERR_DB_CREATE  error renaming it into place
+ */
+int expand_db(int fd, char *dbFile)
+{
+    char tmp[PATH_BUF_SZ];
+    int tmp_fd;
+    int count = 0;
+
+    if (db_is_compact(fd))
+    {
+        tmp_db_path(dbFile, tmp, sizeof(tmp));
+        tmp_fd = open_db(tmp, true);
+        if (tmp_fd < 0)
+            return ERR_DB_FILE;
+
+        if (compact_scan(fd, expand_one, &tmp_fd) != NO_ERROR)
+        {
+            printf(M_ERR_DB_WRITE);
+            close(tmp_fd);
+            unlink(tmp);
+            return ERR_DB_FILE;
+        }
+
+        fd = replace_db(fd, tmp_fd, tmp, dbFile);
+        if (fd < 0)
+            return fd;
+    }
+
+    scan_db(fd, count_record, &count);
+    printf(M_DB_EXPAND_OK, count);
+    return fd;
+}
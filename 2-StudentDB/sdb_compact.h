@@ -0,0 +1,59 @@
+#ifndef __SDB_COMPACT_H__
+    #define __SDB_COMPACT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+//Compact (archival) storage format.  The regular database reserves a 64
+//byte slot per possible id, most of which is name padding.  A compact
+//database instead stores:
+//
+//  header      one 64 byte compact_hdr_t where slot 0 would be.  Slot 0 is
+//              never used by the slot format (ids start at 1), so the magic
+//              number is enough to tell the two formats apart
+//  directory   one uint32_t per id in [min_id, max_id], holding the offset
+//              of the record in the data area plus one (0 means no student)
+//              so an id lookup is still O(1)
+//  data        the live records in id order, each encoded as
+//                  varint   id - previous id (LEB128)
+//                  uint8_t  fname length, then the fname bytes
+//                  uint8_t  lname length, then the lname bytes
+//                  uint16_t gpa, little endian
+//
+//A compact database is read only.  Every read operation works on it, adds
+//and deletes fail until it is expanded back to the slot format with -E.
+#define COMPACT_MAGIC       "SDBCMPT1"
+#define COMPACT_VERSION     1
+
+//largest possible encoded record: 5 byte varint + names + lengths + gpa
+#define COMPACT_MAX_REC     (5 + 1 + 24 + 1 + 32 + 2)
+
+typedef struct compact_hdr
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;         //number of live records
+    uint32_t min_id;
+    uint32_t max_id;
+    uint64_t dir_off;       //file offset of the slot directory
+    uint64_t data_off;      //file offset of the record data
+    uint64_t data_len;
+    char pad[16];
+} compact_hdr_t;
+
+#define M_ERR_DB_COMPACT    "Database is in compact format, expand it with -E first!\n"
+#define M_DB_COMPACT_OK     "Database converted to compact format, %d record(s) in %ld bytes.\n"
+#define M_DB_EXPAND_OK      "Database expanded to slot format, %d record(s).\n"
+
+//prototypes for sdb_compact.c
+bool db_is_compact(int fd);
+bool compact_info(int fd, compact_hdr_t *h);
+int compact_get(int fd, int id, student_t *s);
+int compact_scan(int fd, scan_fn fn, void *ctx);
+int compact_db(int fd, char *dbFile);
+int expand_db(int fd, char *dbFile);
+
+#endif
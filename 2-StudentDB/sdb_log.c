@@ -0,0 +1,624 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_bloom.h"
+#include "sdb_log.h"
+#include "sdb_shard.h"
+
+//database fds that have a change log attached, see log_attach().  A free
+//slot has db_fd -1.  Slots are never moved, so a link found for a handle
+//stays put while other threads attach and detach theirs.
+typedef struct log_link
+{
+    int db_fd;
+    int log_fd;
+    int held;               //log_begin() calls not yet ended, they nest
+    bool slot;              //db_fd is known to be in the slot format
+    char path[PATH_BUF_SZ]; //the database file
+} log_link_t;
+
+static log_link_t links[SHARD_MAX + 1];
+static int n_links;
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t log_chksum(const log_rec_t *rec)
+{
+    log_rec_t tmp = *rec;
+    const unsigned char *p = (const unsigned char *)&tmp;
+    uint32_t h = 2166136261u;
+
+    tmp.chksum = 0;
+    for (size_t i = 0; i < sizeof(tmp); i++)
+    {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void log_path(const char *dbFile, char *buff, size_t len)
+{
+    snprintf(buff, len, "%s%s", dbFile, LOG_FILE_SUFFIX);
+}
+
+static log_link_t *find_link(int db_fd)
+{
+    log_link_t *l = NULL;
+
+    if (db_fd < 0)
+        return NULL;
+    pthread_mutex_lock(&links_lock);
+    for (int i = 0; i < n_links && l == NULL; i++)
+        if (links[i].db_fd == db_fd)
+            l = &links[i];
+    pthread_mutex_unlock(&links_lock);
+    return l;
+}
+
+//a free slot of links[], NULL if all are in use.  links_lock is held
+static log_link_t *free_link(void)
+{
+    for (int i = 0; i < n_links; i++)
+        if (links[i].db_fd < 0)
+            return &links[i];
+    if (n_links == (int)(sizeof(links) / sizeof(links[0])))
+        return NULL;
+    return &links[n_links++];
+}
+
+/*
+ *  log_attach
+ *      db_fd:   fd of an open database file
+ *      dbFile:  name of that database file
+ *
+ *  Opens (creating if needed) the change log of dbFile.  From then on
+ *  log_event() calls for db_fd are appended to it.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int log_attach(int db_fd, const char *dbFile)
+{
+    char path[PATH_BUF_SZ];
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    log_link_t *l;
+    int log_fd;
+
+    log_path(dbFile, path, sizeof(path));
+    log_fd = open(path, O_RDWR | O_CREAT | O_APPEND, mode);
+    if (log_fd < 0)
+        return ERR_DB_FILE;
+
+    pthread_mutex_lock(&links_lock);
+    if ((l = free_link()) != NULL)
+    {
+        l->db_fd = db_fd;
+        l->log_fd = log_fd;
+        l->held = 0;
+        l->slot = false;
+        snprintf(l->path, sizeof(l->path), "%s", dbFile);
+    }
+    pthread_mutex_unlock(&links_lock);
+    if (l == NULL)
+    {
+        close(log_fd);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+void log_detach(int db_fd)
+{
+    log_link_t *l = find_link(db_fd);
+
+    if (l != NULL)
+    {
+        close(l->log_fd);
+        pthread_mutex_lock(&links_lock);
+        l->db_fd = -1;
+        pthread_mutex_unlock(&links_lock);
+    }
+}
+
+/*
+ *  log_begin
+ *      db_fd:  fd of the database about to be changed
+ *
+ *  Takes the change log lock of db_fd and keeps it until log_end().  The
+ *  lock is what an online compaction (-x) holds while it catches up and
+ *  swaps the database file, so a writer holding it knows its change either
+ *  lands in the file the compaction copies from before the catch up, or in
+ *  the new file.  The file is then followed, see log_follow().
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int log_begin(int db_fd)
+{
+    log_link_t *l = find_link(db_fd);
+
+    if (l == NULL)
+        return NO_ERROR;
+    if (l->held > 0)
+    {
+        l->held++;
+        return NO_ERROR;
+    }
+    if (flock(l->log_fd, LOCK_EX) == -1)
+        return ERR_DB_FILE;
+    l->held = 1;
+
+    if (log_follow(db_fd) != NO_ERROR)
+    {
+        log_end(db_fd);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  log_follow
+ *      db_fd:  fd of a database with a change log attached
+ *
+ *  If another process replaced the database file since db_fd was opened
+ *  (-x, -K, -E, -L rename a new file over it) the new file is opened onto
+ *  the same fd number, otherwise the reader would go on reading the old,
+ *  unlinked file.  Writers get this from log_begin(), readers call it
+ *  once per session command or libsdb call.  The rename is atomic, so the
+ *  file found is always a complete one.  A file that is gone (-S moved its
+ *  records into shards) is an error, there is nothing left to follow.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int log_follow(int db_fd)
+{
+    log_link_t *l = find_link(db_fd);
+    struct stat cur, now;
+    int new_fd;
+
+    if (l == NULL)
+        return NO_ERROR;
+    if (fstat(db_fd, &cur) == -1 || stat(l->path, &now) == -1)
+        return ERR_DB_FILE;
+    if (cur.st_ino == now.st_ino && cur.st_dev == now.st_dev)
+        return NO_ERROR;
+
+    new_fd = open(l->path, O_RDWR);
+    if (new_fd < 0 || dup2(new_fd, db_fd) == -1)
+    {
+        if (new_fd >= 0)
+            close(new_fd);
+        return ERR_DB_FILE;
+    }
+    close(new_fd);
+    l->slot = false;
+    return NO_ERROR;
+}
+
+void log_end(int db_fd)
+{
+    log_link_t *l = find_link(db_fd);
+
+    if (l != NULL && l->held > 0 && --l->held == 0)
+        flock(l->log_fd, LOCK_UN);
+}
+
+//the database file db_fd was attached with, NULL if it has no log
+const char *log_db_file(int db_fd)
+{
+    log_link_t *l = find_link(db_fd);
+
+    return (l == NULL) ? NULL : l->path;
+}
+
+//db_is_compact() keeps the format of db_fd here so it reads the header
+//once.  Only the slot format is kept: a database never turns compact in
+//place, -K renames a new file over it.  The process that renamed it clears
+//the note, any other one notices the new file in log_follow().
+bool log_slot_known(int db_fd)
+{
+    log_link_t *l = find_link(db_fd);
+
+    return l != NULL && l->slot;
+}
+
+void log_slot_note(int db_fd, bool slot)
+{
+    log_link_t *l = find_link(db_fd);
+
+    if (l != NULL)
+        l->slot = slot;
+}
+
+/*
+ *  log_seq
+ *      db_fd:  fd of a database with a change log attached
+ *
+ *  returns:  the sequence number of the last record in the log, 0 if the
+ *            log is empty or none is attached
+ */
+unsigned long long log_seq(int db_fd)
+{
+    log_link_t *l = find_link(db_fd);
+
+    return (l == NULL) ? 0 : log_fd_seq(l->log_fd);
+}
+
+//the log fd attached to db_fd, -1 if none.  It stays open until
+//log_detach(), so callers may keep it and use log_fd_seq() without
+//looking the link up again.
+int log_fd(int db_fd)
+{
+    log_link_t *l = find_link(db_fd);
+
+    return (l == NULL) ? -1 : l->log_fd;
+}
+
+//log_seq() for a log fd from log_fd(), takes no lock
+unsigned long long log_fd_seq(int log_fd)
+{
+    struct stat st;
+
+    if (log_fd < 0 || fstat(log_fd, &st) == -1)
+        return 0;
+    return st.st_size / sizeof(log_rec_t);
+}
+
+/*
+ *  log_event
+ *      db_fd:  fd of the database that was changed
+ *      op:     LOG_OP_* constant
+ *      *s:     the slot contents after the change, NULL for LOG_OP_ZERO
+ *
+ *  Appends one record to the change log of db_fd.  The log is locked while
+ *  the next sequence number is worked out from its size so concurrent
+ *  sdbsc processes never hand out the same number.  A partial record left
+ *  at the end by a crash is cut off first.  If no log is attached to db_fd
+ *  this does nothing.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int log_event(int db_fd, int op, const student_t *s)
+{
+    log_link_t *l = find_link(db_fd);
+    log_rec_t rec = {0};
+    struct stat st;
+    int log_fd;
+    int rc = NO_ERROR;
+
+    if (l == NULL)
+        return NO_ERROR;
+
+    log_fd = l->log_fd;
+    if (!l->held && flock(log_fd, LOCK_EX) == -1)
+        return ERR_DB_FILE;
+
+    if (fstat(log_fd, &st) == -1)
+        rc = ERR_DB_FILE;
+    else if (st.st_size % sizeof(log_rec_t) != 0 &&
+             ftruncate(log_fd, st.st_size - st.st_size % sizeof(log_rec_t)) == -1)
+        rc = ERR_DB_FILE;
+
+    if (rc == NO_ERROR)
+    {
+        rec.seq = st.st_size / sizeof(log_rec_t) + 1;
+        rec.op = op;
+        if (s != NULL)
+            rec.student = *s;
+        rec.chksum = log_chksum(&rec);
+
+        if (write(log_fd, &rec, sizeof(rec)) != sizeof(rec))
+            rc = ERR_DB_FILE;
+    }
+
+    if (!l->held)
+        flock(log_fd, LOCK_UN);
+    return rc;
+}
+
+//applies one log record to the database behind fd
+static int apply_rec(int fd, const log_rec_t *rec)
+{
+    off_t offset = (off_t)rec->student.id * sizeof(student_t);
+
+    switch (rec->op)
+    {
+    case LOG_OP_ADD:
+    case LOG_OP_DEL:
+        if (rec->student.id < MIN_STD_ID || rec->student.id > MAX_STD_ID)
+            return ERR_DB_FILE;
+        if (rec->op == LOG_OP_DEL)
+        {
+            student_t empty_student = EMPTY_STUDENT_RECORD;
+            return pwrite(fd, &empty_student, sizeof(student_t), offset) == sizeof(student_t)
+                       ? NO_ERROR : ERR_DB_FILE;
+        }
+        bloom_add(fd, &rec->student);
+        return pwrite(fd, &rec->student, sizeof(student_t), offset) == sizeof(student_t)
+                   ? NO_ERROR : ERR_DB_FILE;
+    case LOG_OP_ZERO:
+        return (ftruncate(fd, 0) == 0) ? NO_ERROR : ERR_DB_FILE;
+    default:
+        return ERR_DB_FILE;
+    }
+}
+
+/*
+ *  apply_log
+ *
+ *  Applies the records of the log behind log_fd that follow *seq to the
+ *  database behind fd, advancing *seq.  It stops at the first record that
+ *  is incomplete or still being written, that one is picked up next time.
+ *
+ *  returns:  the number of records applied, or ERR_DB_FILE
+ */
+static int apply_log(int log_fd, int fd, unsigned long long *seq)
+{
+    log_rec_t recs[REPL_BATCH];
+    int applied = 0;
+
+    for (;;)
+    {
+        ssize_t bytes = pread(log_fd, recs, sizeof(recs), *seq * sizeof(log_rec_t));
+        if (bytes < 0)
+            return ERR_DB_FILE;
+
+        int n = bytes / sizeof(log_rec_t);
+        for (int i = 0; i < n; i++)
+        {
+            if (recs[i].seq != *seq + 1 || recs[i].chksum != log_chksum(&recs[i]))
+                return applied;
+            if (apply_rec(fd, &recs[i]) != NO_ERROR)
+                return ERR_DB_FILE;
+            (*seq)++;
+            applied++;
+        }
+        if (n < REPL_BATCH)
+            return applied;
+    }
+}
+
+/*
+ *  log_catch_up
+ *      db_fd:   fd of a database with a change log attached
+ *      dst_fd:  a copy of that database
+ *      *seq:    the log position the copy was taken at, advanced
+ *
+ *  Replays the changes made to db_fd since *seq onto dst_fd.  Used by
+ *  compress_db() for the writes that arrived while it was copying.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int log_catch_up(int db_fd, int dst_fd, unsigned long long *seq)
+{
+    log_link_t *l = find_link(db_fd);
+
+    if (l == NULL)
+        return NO_ERROR;
+    return (apply_log(l->log_fd, dst_fd, seq) < 0) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  ---------------------------------------------------------------------
+ *  replica side
+ *  ---------------------------------------------------------------------
+ */
+static unsigned long long load_repl_seq(bool *found)
+{
+    unsigned long long seq = 0;
+    FILE *f = fopen(REPL_STATE_FILE, "r");
+
+    *found = (f != NULL);
+    if (f != NULL)
+    {
+        if (fscanf(f, "%llu", &seq) != 1)
+            *found = false;
+        fclose(f);
+    }
+    return seq;
+}
+
+static int save_repl_seq(unsigned long long seq)
+{
+    char tmp[PATH_BUF_SZ];
+    FILE *f;
+
+    tmp_db_path(REPL_STATE_FILE, tmp, sizeof(tmp));
+    if ((f = fopen(tmp, "w")) == NULL)
+        return ERR_DB_FILE;
+
+    fprintf(f, "%llu\n", seq);
+    bool written = (fflush(f) == 0 && fsync(fileno(f)) == 0);
+    if (fclose(f) != 0 || !written || rename(tmp, REPL_STATE_FILE) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  snapshot_primary
+ *
+ *  Seeds an empty replica with a full copy of the primary database.  The
+ *  log position is taken before the copy starts: every change up to it is
+ *  already in the database file, and anything that lands during the copy
+ *  is simply applied again from the log afterwards.  All zero blocks are
+ *  skipped so the copy stays as sparse as the original.
+ *
+ *  returns:  the fd of the new local database, or ERR_DB_FILE
+ */
+static int snapshot_primary(int fd, const char *primary_db, const char *primary_log,
+                            unsigned long long *seq)
+{
+    static const char zeros[SCAN_BLOCK_SZ];
+    char tmp[PATH_BUF_SZ];
+    char *block;
+    struct stat st;
+    off_t offset = 0;
+    ssize_t n;
+    int src, dst;
+
+    *seq = (stat(primary_log, &st) == 0) ? st.st_size / sizeof(log_rec_t) : 0;
+
+    if ((src = open(primary_db, O_RDONLY)) < 0)
+        return ERR_DB_FILE;
+
+    tmp_db_path(DB_FILE, tmp, sizeof(tmp));
+    if ((dst = open_db(tmp, true)) < 0 || (block = malloc(SCAN_BLOCK_SZ)) == NULL)
+    {
+        close(src);
+        if (dst >= 0)
+            close(dst);
+        return ERR_DB_FILE;
+    }
+
+    while ((n = pread(src, block, SCAN_BLOCK_SZ, offset)) > 0)
+    {
+        if (memcmp(block, zeros, n) != 0 && pwrite(dst, block, n, offset) != n)
+            break;
+        offset += n;
+    }
+    free(block);
+    close(src);
+
+    if (n != 0 || ftruncate(dst, offset) == -1 || fsync(dst) == -1 ||
+        rename(tmp, DB_FILE) == -1)
+    {
+        close(dst);
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+
+    close(fd);
+    return dst;
+}
+
+/*
+ *  replicate
+ *      primary_dir:  directory holding the primary DB_FILE and its log
+ *      once:         apply what is in the log now and return
+ *      interval_ms:  how often to poll the primary log for new records
+ *
+ *  Keeps DB_FILE in the current directory as a read replica of the one in
+ *  primary_dir.  The first time it runs the replica is seeded with a copy
+ *  of the primary database, after that only new log records are read and
+ *  applied, so the work done is proportional to the change volume, not to
+ *  the database size.  The last applied sequence number is stored in
+ *  REPL_STATE_FILE after the replica database has been synced, so an
+ *  interrupted replica resumes where it left off.
+ *
+ *  returns:  NO_ERROR       (once) everything in the log was applied
+ *            ERR_DB_FILE    database or log file I/O issue
+ *            ERR_DB_OP      the primary is sharded
+ *
+ *  console:  M_REPL_SNAPSHOT  when the replica is seeded
+ *            M_REPL_APPLIED   after every batch of changes applied
+ */
+int replicate(const char *primary_dir, bool once, int interval_ms)
+{
+    char primary_db[PATH_BUF_SZ];
+    char primary_log[PATH_BUF_SZ];
+    unsigned long long applied;
+    bool found;
+    int log_fd = -1;
+    int fd;
+    int rc = NO_ERROR;
+
+    snprintf(primary_db, sizeof(primary_db), "%s/%s", primary_dir, SHARD_MANIFEST);
+    if (access(primary_db, F_OK) == 0)
+    {
+        printf(M_ERR_REPL_SHARDED);
+        return ERR_DB_OP;
+    }
+    snprintf(primary_db, sizeof(primary_db), "%s/%s", primary_dir, DB_FILE);
+    log_path(primary_db, primary_log, sizeof(primary_log));
+
+    if ((fd = open_db(DB_FILE, false)) < 0)
+        return ERR_DB_FILE;
+
+    applied = load_repl_seq(&found);
+    if (!found)
+    {
+        // any name filter belonged to the database being replaced
+        char filter[PATH_BUF_SZ];
+        snprintf(filter, sizeof(filter), "%s%s", DB_FILE, BLOOM_FILE_SUFFIX);
+        unlink(filter);
+
+        fd = snapshot_primary(fd, primary_db, primary_log, &applied);
+        if (fd < 0 || save_repl_seq(applied) != NO_ERROR)
+        {
+            printf(M_ERR_DB_CREATE);
+            return ERR_DB_FILE;
+        }
+        printf(M_REPL_SNAPSHOT, primary_db, applied);
+        fflush(stdout);
+    }
+
+    // the replica is written like any other database: under its own log
+    // lock, so -x and name filter rebuilds in this directory stay safe, and
+    // keeping its name filter up to date
+    if (log_attach(fd, DB_FILE) != NO_ERROR)
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+    bloom_attach(fd, DB_FILE);
+
+    for (;;)
+    {
+        int n_applied = 0;
+
+        // the primary log only appears after its first change
+        if (log_fd < 0)
+            log_fd = open(primary_log, O_RDONLY);
+
+        if (log_fd >= 0 && (rc = log_begin(fd)) == NO_ERROR)
+        {
+            n_applied = apply_log(log_fd, fd, &applied);
+            log_end(fd);
+        }
+        if (rc != NO_ERROR || n_applied < 0)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        if (n_applied > 0)
+        {
+            if (fsync(fd) == -1 || save_repl_seq(applied) != NO_ERROR)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            printf(M_REPL_APPLIED, applied, n_applied);
+            fflush(stdout);
+        }
+
+        if (once)
+            break;
+        usleep(interval_ms * 1000);
+    }
+
+    if (log_fd >= 0)
+        close(log_fd);
+    bloom_detach(fd);
+    log_detach(fd);
+    close(fd);
+    return rc;
+}
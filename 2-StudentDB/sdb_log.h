@@ -0,0 +1,65 @@
+#ifndef __SDB_LOG_H__
+    #define __SDB_LOG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "sdbsc.h"
+
+//Change log.  Every mutation of a database file is also appended to an
+//append-only log next to it (student.db -> student.db.log).  Records are
+//fixed size and numbered from 1 with no gaps, so the record with sequence
+//number n always lives at offset (n - 1) * sizeof(log_rec_t) and a reader
+//that has applied everything up to n simply reads on from there.
+//
+//Each record carries the full state of the slot after the change, so
+//applying a record twice is harmless, and an in place update of a slot is
+//logged as LOG_OP_ADD of the new contents.
+//
+//-L is logged as LOG_OP_ZERO followed by one LOG_OP_ADD per restored
+//record.  -K and -E rewrite the file without changing its records, so
+//there is nothing to log, and -S leaves a sharded database that -R does
+//not replicate.
+#define LOG_FILE_SUFFIX     ".log"
+
+#define LOG_OP_ADD          1       //student written to its slot
+#define LOG_OP_DEL          2       //slot cleared
+#define LOG_OP_ZERO         3       //database truncated (-z)
+
+typedef struct log_rec
+{
+    uint64_t seq;
+    uint32_t op;
+    uint32_t chksum;        //FNV-1a of the record with chksum set to 0
+    student_t student;
+} log_rec_t;
+
+//Replication (-R).  The replica keeps the last applied sequence number in
+//a small state file next to its own DB_FILE.
+#define REPL_STATE_FILE     "student.db.replseq"
+#define REPL_DEF_INTERVAL   500     //ms between polls of the primary log
+#define REPL_BATCH          256     //log records applied per read
+
+#define M_ERR_LOG_WRITE     "Error writing change log, replicas may be stale!\n"
+#define M_ERR_REPL_SHARDED  "Replicating a sharded database is not supported.\n"
+#define M_REPL_SNAPSHOT     "Replica seeded from %s at sequence %llu.\n"
+#define M_REPL_APPLIED      "Replica at sequence %llu, applied %d change(s).\n"
+
+//prototypes for sdb_log.c
+int log_attach(int db_fd, const char *dbFile);
+void log_detach(int db_fd);
+int log_begin(int db_fd);
+void log_end(int db_fd);
+int log_follow(int db_fd);
+const char *log_db_file(int db_fd);
+bool log_slot_known(int db_fd);
+void log_slot_note(int db_fd, bool slot);
+unsigned long long log_seq(int db_fd);
+int log_fd(int db_fd);
+unsigned long long log_fd_seq(int log_fd);
+int log_event(int db_fd, int op, const student_t *s);
+int log_catch_up(int db_fd, int dst_fd, unsigned long long *seq);
+int replicate(const char *primary_dir, bool once, int interval_ms);
+
+#endif
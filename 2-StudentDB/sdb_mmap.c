@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_mmap.h"
+
+static int scan_flags;
+
+//the mapped scan running on this thread, see scan_sigbus()
+static __thread sigjmp_buf *scan_jmp;
+
+/*
+ *  scan_sigbus
+ *
+ *  Touching a page of a mapping past the end of its file raises SIGBUS.
+ *  That happens when another process truncates the database during a
+ *  scan (-z, or a replica applying LOG_OP_ZERO).  The scan on the faulting
+ *  thread is abandoned, see mmap_scan().  A SIGBUS outside of a scan gets
+ *  the default action when the faulting access is retried.
+ */
+static void scan_sigbus(int sig)
+{
+    if (scan_jmp != NULL)
+        siglongjmp(*scan_jmp, 1);
+    signal(sig, SIG_DFL);
+}
+
+void mmap_scan_mode(int flags)
+{
+    struct sigaction sa = {0};
+
+    // prefaulting only makes sense for a mapping
+    scan_flags = (flags & MMAP_PREFAULT) ? (flags | MMAP_SCAN) : flags;
+
+    if (scan_flags & MMAP_SCAN)
+    {
+        sa.sa_handler = scan_sigbus;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGBUS, &sa, NULL);
+    }
+}
+
+int mmap_scan_flags(void)
+{
+    return scan_flags;
+}
+
+#ifndef MADV_POPULATE_READ
+    #define MADV_POPULATE_READ  22      // linux 5.14, older headers lack it
+#endif
+
+/*
+ *  prefault_extents
+ *
+ *  Faults in the data extents of the len bytes of fd mapped at map, holes
+ *  are skipped with SEEK_DATA and SEEK_HOLE as in mmap_scan().  Each extent
+ *  is populated with MADV_POPULATE_READ, on kernels without it one byte of
+ *  every page is read instead.
+ *
+ *  returns:  nothing, a failed prefault only costs the faults it saves
+ */
+static void prefault_extents(int fd, const char *map, size_t len)
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    off_t offset = 0;
+
+    while (offset < (off_t)len)
+    {
+        off_t data = lseek(fd, offset, SEEK_DATA);
+        if (data == -1)
+            return;
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > (off_t)len)
+            hole = len;
+
+        const char *from = map + (data & ~(off_t)(page - 1));
+        const char *to = map + hole;
+        if (madvise((void *)from, to - from, MADV_POPULATE_READ) == -1)
+        {
+            for (const volatile char *p = from; p < to; p += page)
+                (void)*p;
+        }
+        offset = hole;
+    }
+}
+
+/*
+ *  map_db
+ *
+ *  Maps len bytes of fd read only for a sequential scan.  For --prefault
+ *  the mapping is placed on a MMAP_HUGE_SZ boundary, which huge pages
+ *  need, by reserving a bit more address space than needed and mapping
+ *  the file over the aligned part of it.  The huge page hint goes on the
+ *  file mapping itself, mmap_scan() faults its data extents in after that.
+ *
+ *  returns:  the mapping or MAP_FAILED
+ */
+static char *map_db(int fd, size_t len)
+{
+    char *base, *aligned, *map;
+
+    if (!(scan_flags & MMAP_PREFAULT))
+    {
+        map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+            madvise(map, len, MADV_SEQUENTIAL);
+        return map;
+    }
+
+    base = mmap(NULL, len + MMAP_HUGE_SZ, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return MAP_FAILED;
+
+    aligned = (char *)(((uintptr_t)base + MMAP_HUGE_SZ - 1) & ~((uintptr_t)MMAP_HUGE_SZ - 1));
+    if (aligned > base)
+        munmap(base, aligned - base);
+    munmap(aligned + len, (base + len + MMAP_HUGE_SZ) - (aligned + len));
+
+    map = mmap(aligned, len, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        munmap(aligned, len);
+        return MAP_FAILED;
+    }
+    madvise(map, len, MADV_HUGEPAGE);
+    madvise(map, len, MADV_SEQUENTIAL);
+    return map;
+}
+
+//walks the data extents of the len bytes of fd mapped at map, for mmap_scan()
+static int walk_map(int fd, const char *map, off_t len, scan_fn fn, void *ctx)
+{
+    student_t s;
+    off_t offset = 0;
+    int rc = NO_ERROR;
+
+    while (rc == NO_ERROR && offset < len)
+    {
+        off_t data = lseek(fd, offset, SEEK_DATA);
+        if (data == -1)
+        {
+            if (errno != ENXIO)
+                rc = ERR_DB_FILE;
+            break;
+        }
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > len)
+            hole = len;
+
+        offset = data - (data % sizeof(student_t));
+        for (; offset + (off_t)sizeof(student_t) <= hole && rc == NO_ERROR;
+             offset += sizeof(student_t))
+        {
+            // fn gets a copy, so a truncate can only fault in this memcpy
+            // and never with fn part way through, e.g. holding stdout
+            memcpy(&s, map + offset, sizeof(s));
+            if (s.id != DELETED_STUDENT_ID)
+                rc = fn(&s, ctx);
+        }
+        // holes are block aligned, only a torn record at EOF ends up here
+        if (offset < hole)
+            break;
+    }
+    return rc;
+}
+
+/*
+ *  mmap_scan
+ *      fd:   linux file descriptor of a slot format database
+ *      fn:   callback invoked for every live student record
+ *      ctx:  passed through to fn
+ *
+ *  The mapped equivalent of the block read path of scan_db().  Only the
+ *  data extents of the file are walked, holes are skipped with SEEK_DATA
+ *  and SEEK_HOLE so they are never faulted in.  If the file is truncated
+ *  under the mapping the SIGBUS lands back here, see scan_sigbus().
+ *
+ *  returns:  same as scan_db(), ERR_DB_FILE if the file was truncated
+ *
+ *  console:  Does not produce any console I/O
+ */
+int mmap_scan(int fd, scan_fn fn, void *ctx)
+{
+    sigjmp_buf jmp;
+    struct stat st;
+    char *map;
+    int rc = ERR_DB_FILE;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+    if (st.st_size < (off_t)sizeof(student_t))
+        return NO_ERROR;
+
+    map = map_db(fd, st.st_size);
+    if (map == MAP_FAILED)
+        return ERR_DB_FILE;
+
+    if (sigsetjmp(jmp, 1) == 0)
+    {
+        scan_jmp = &jmp;
+        if (scan_flags & MMAP_PREFAULT)
+            prefault_extents(fd, map, st.st_size);
+        rc = walk_map(fd, map, st.st_size, fn, ctx);
+    }
+    scan_jmp = NULL;
+
+    munmap(map, st.st_size);
+    return rc;
+}
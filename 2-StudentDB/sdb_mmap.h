@@ -0,0 +1,27 @@
+#ifndef __SDB_MMAP_H__
+    #define __SDB_MMAP_H__
+
+#include "db.h"
+#include "sdbsc.h"
+
+//Memory mapped scans.  With --mmap the full database scans (count, print,
+//sort, top K, ...) walk a read only mapping of the file instead of
+//pread()ing it in blocks.  --prefault also asks for transparent huge
+//pages on the mapping and then populates its data extents, holes left
+//out, with MADV_POPULATE_READ, so a cold scan takes one burst of read
+//ahead instead of a page fault every 4 KiB.  Huge pages for file mappings
+//depend on the file system and kernel config, without them the mapping
+//silently uses normal pages.
+//
+//A scan whose file is truncated under it by another process fails with
+//ERR_DB_FILE instead of dying of SIGBUS.
+#define MMAP_SCAN           0x01    //scan through a mapping of the file
+#define MMAP_PREFAULT       0x02    //ask for huge pages, populate it up front
+#define MMAP_HUGE_SZ        (2*1024*1024)
+
+//prototypes for sdb_mmap.c
+void mmap_scan_mode(int flags);
+int mmap_scan_flags(void);
+int mmap_scan(int fd, scan_fn fn, void *ctx);
+
+#endif
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_bloom.h"
+#include "sdb_compact.h"
+#include "sdb_query.h"
+#include "sdb_shard.h"
+
+//parses N or LO-HI into [*lo, *hi], both within [min, max]
+static bool parse_range(const char *v, int min, int max, int *lo, int *hi)
+{
+    char *end;
+    long a = strtol(v, &end, 10);
+    long b = a;
+
+    if (end == v)
+        return false;
+    if (*end == '-')
+    {
+        v = end + 1;
+        b = strtol(v, &end, 10);
+        if (end == v)
+            return false;
+    }
+    if (*end != '\0' || a < min || b > max || a > b)
+        return false;
+
+    // repeated terms narrow the range
+    *lo = (a > *lo) ? a : *lo;
+    *hi = (b < *hi) ? b : *hi;
+    return true;
+}
+
+//parses NAME or PREFIX* into a name field of size len
+static bool parse_name(const char *v, char *name, size_t len, bool *prefix)
+{
+    size_t n = strlen(v);
+
+    *prefix = (n > 0 && v[n - 1] == '*');
+    if (*prefix)
+        n--;
+    if (n == 0 && !*prefix)
+        return false;
+    snprintf(name, len, "%.*s", (int)n, v);
+    return true;
+}
+
+/*
+ *  parse_query
+ *      terms:    the query terms from the command line, see sdb_query.h
+ *      nterms:   number of terms
+ *      *q:       the query
+ *      *explain: set if --explain is one of the terms
+ *
+ *  returns:  NO_ERROR or ERR_DB_OP if a term is malformed or out of range
+ *
+ *  console:  Does not produce any console I/O
+ */
+int parse_query(char **terms, int nterms, query_t *q, bool *explain)
+{
+    bool ok = true;
+
+    memset(q, 0, sizeof(*q));
+    q->id_lo = MIN_STD_ID;
+    q->id_hi = MAX_STD_ID;
+    q->gpa_lo = MIN_STD_GPA;
+    q->gpa_hi = MAX_STD_GPA;
+    *explain = false;
+
+    for (int i = 0; i < nterms && ok; i++)
+    {
+        const char *t = terms[i];
+
+        if (strcmp(t, "--explain") == 0)
+            *explain = true;
+        else if (strncmp(t, "id=", 3) == 0)
+            ok = parse_range(t + 3, MIN_STD_ID, MAX_STD_ID, &q->id_lo, &q->id_hi);
+        else if (strncmp(t, "gpa=", 4) == 0)
+            ok = parse_range(t + 4, MIN_STD_GPA, MAX_STD_GPA, &q->gpa_lo, &q->gpa_hi);
+        else if (strncmp(t, "fname=", 6) == 0)
+            ok = parse_name(t + 6, q->fname, sizeof(q->fname), &q->fname_prefix);
+        else if (strncmp(t, "lname=", 6) == 0)
+            ok = parse_name(t + 6, q->lname, sizeof(q->lname), &q->lname_prefix);
+        else
+            ok = false;
+    }
+
+    // narrowing two terms can leave nothing
+    if (ok && (q->id_lo > q->id_hi || q->gpa_lo > q->gpa_hi))
+        ok = false;
+    return ok ? NO_ERROR : ERR_DB_OP;
+}
+
+/*
+ *  plan_query
+ *      fd:       linux file descriptor of one database file
+ *      dbFile:   name of that file, for its name filter
+ *      min_id:   lowest id the file can hold (its shard bounds)
+ *      max_id:   highest id the file can hold
+ *      *q:       the query
+ *      *p:       the plan, see sdb_query.h
+ *
+ *  Picks the cheapest access path for q on fd.  The cost of an access path
+ *  is the number of records it reads: the slots (or compact directory
+ *  entries) of the id range for a range read, the allocated slots (or the
+ *  record count) for a full scan.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int plan_query(int fd, const char *dbFile, int min_id, int max_id, const query_t *q,
+               query_plan_t *p)
+{
+    compact_hdr_t h;
+    struct stat st;
+    int last;
+
+    memset(p, 0, sizeof(*p));
+    p->lo = (q->id_lo > min_id) ? q->id_lo : min_id;
+    p->hi = (q->id_hi < max_id) ? q->id_hi : max_id;
+
+    if (compact_info(fd, &h))
+    {
+        p->scan_cost = h.count;
+        if (h.count == 0)
+            p->lo = p->hi + 1; // nothing to read
+        if (p->lo < (int)h.min_id)
+            p->lo = h.min_id;
+        last = h.max_id;
+    }
+    else
+    {
+        if (fstat(fd, &st) == -1)
+            return ERR_DB_FILE;
+        // slot 0 is never used, scans skip the holes of sparse files
+        last = (int)(st.st_size / sizeof(student_t)) - 1;
+        p->scan_cost = (long)st.st_blocks * 512 / sizeof(student_t);
+        if (p->scan_cost > last + 1)
+            p->scan_cost = last + 1;
+    }
+    if (p->hi > last)
+        p->hi = last;
+    p->cost = (p->lo <= p->hi) ? (long)p->hi - p->lo + 1 : 0;
+
+    if (p->lo > p->hi)
+    {
+        p->access = QPLAN_EMPTY;
+        p->why = "no id in the query range";
+    }
+    else if (q->fname[0] != '\0' && !q->fname_prefix && q->lname[0] != '\0' &&
+             !q->lname_prefix && bloom_attach(fd, dbFile) == NO_ERROR &&
+             !bloom_may_contain(fd, q->fname, q->lname))
+    {
+        p->access = QPLAN_EMPTY;
+        p->why = "the name filter rules the name out";
+    }
+    else if (p->lo == p->hi)
+        p->access = QPLAN_DIRECT;
+    else if (p->cost <= p->scan_cost)
+        p->access = QPLAN_RANGE;
+    else
+        p->access = QPLAN_SCAN;
+    return NO_ERROR;
+}
+
+static void explain_plan(const char *dbFile, const query_plan_t *p)
+{
+    switch (p->access)
+    {
+    case QPLAN_EMPTY:
+        printf(M_QPLAN_EMPTY, dbFile, p->why);
+        break;
+    case QPLAN_DIRECT:
+        printf(M_QPLAN_DIRECT, dbFile, p->lo);
+        break;
+    case QPLAN_RANGE:
+        printf(M_QPLAN_RANGE, dbFile, p->lo, p->hi, p->cost, p->scan_cost);
+        break;
+    default:
+        printf(M_QPLAN_SCAN, dbFile, p->scan_cost, p->cost);
+        break;
+    }
+}
+
+/*
+ *  read_ids
+ *
+ *  The direct and range access paths: hands the live records with ids in
+ *  [lo, hi] to fn in id order.  Slot format files are read in
+ *  SCAN_BLOCK_SZ chunks starting at the slot of lo, compact files through
+ *  their directory.
+ *
+ *  returns:  same as scan_db()
+ */
+static int read_ids(int fd, int lo, int hi, scan_fn fn, void *ctx)
+{
+    off_t offset = (off_t)lo * sizeof(student_t);
+    off_t end = ((off_t)hi + 1) * sizeof(student_t);
+    student_t *block;
+    ssize_t bytes_read;
+    int rc = NO_ERROR;
+
+    if (db_is_compact(fd))
+    {
+        student_t s;
+
+        for (int id = lo; id <= hi && rc == NO_ERROR; id++)
+        {
+            int got = compact_get(fd, id, &s);
+            if (got == ERR_DB_FILE)
+                return ERR_DB_FILE;
+            if (got == NO_ERROR)
+                rc = fn(&s, ctx);
+        }
+        return rc;
+    }
+
+    block = malloc(SCAN_BLOCK_SZ);
+    if (block == NULL)
+        return ERR_DB_FILE;
+
+    while (rc == NO_ERROR && offset < end)
+    {
+        size_t len = (end - offset < SCAN_BLOCK_SZ) ? end - offset : SCAN_BLOCK_SZ;
+
+        bytes_read = pread(fd, block, len, offset);
+        if (bytes_read < 0)
+            rc = ERR_DB_FILE;
+        if (bytes_read <= 0)
+            break;
+
+        int n = bytes_read / sizeof(student_t);
+        for (int i = 0; i < n && rc == NO_ERROR; i++)
+        {
+            if (block[i].id != DELETED_STUDENT_ID)
+                rc = fn(&block[i], ctx);
+        }
+        offset += bytes_read;
+    }
+
+    free(block);
+    return rc;
+}
+
+//what run_query() is looking for, and how many rows it printed
+typedef struct query_ctx
+{
+    const query_t *q;
+    int *printed;
+} query_ctx_t;
+
+static bool name_matches(const char *name, size_t len, const char *want, bool prefix)
+{
+    if (want[0] == '\0')
+        return true;
+    if (prefix)
+        return strncmp(name, want, strlen(want)) == 0;
+    return strncmp(name, want, len - 1) == 0;
+}
+
+//scan_fn for every access path, checks the whole predicate
+static int match_query(const student_t *s, void *ctx)
+{
+    query_ctx_t *c = ctx;
+    const query_t *q = c->q;
+
+    if (s->id < q->id_lo || s->id > q->id_hi || s->gpa < q->gpa_lo || s->gpa > q->gpa_hi ||
+        !name_matches(s->fname, sizeof(s->fname), q->fname, q->fname_prefix) ||
+        !name_matches(s->lname, sizeof(s->lname), q->lname, q->lname_prefix))
+        return NO_ERROR;
+
+    if ((*c->printed)++ == 0)
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST NAME", "GPA");
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0);
+    return NO_ERROR;
+}
+
+//plans and runs (or explains) q on one database file
+static int query_file(int fd, const char *dbFile, int min_id, int max_id, const query_t *q,
+                      bool explain, int *printed)
+{
+    query_ctx_t c = {q, printed};
+    query_plan_t p;
+
+    if (plan_query(fd, dbFile, min_id, max_id, q, &p) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (explain)
+    {
+        explain_plan(dbFile, &p);
+        return NO_ERROR;
+    }
+
+    switch (p.access)
+    {
+    case QPLAN_EMPTY:
+        return NO_ERROR;
+    case QPLAN_DIRECT:
+    case QPLAN_RANGE:
+        return read_ids(fd, p.lo, p.hi, match_query, &c);
+    default:
+        return scan_db(fd, match_query, &c);
+    }
+}
+
+/*
+ *  run_query
+ *      fd:       linux file descriptor of the database, -1 if sharded
+ *      shards:   the shards of a sharded database
+ *      *q:       the query
+ *      explain:  print the plans instead of running the query
+ *      printed:  counts the students printed, the header goes before the
+ *                first one
+ *
+ *  Runs q on the database file, or on every shard with its own plan.  The
+ *  students are printed in the -f format, in id order.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  the students found, or with explain one plan line per file
+ */
+int run_query(int fd, shard_set_t *shards, const query_t *q, bool explain, int *printed)
+{
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < shards->n && rc == NO_ERROR; i++)
+        rc = query_file(shards->shards[i].fd, shards->shards[i].path, shards->shards[i].min_id,
+                        shards->shards[i].max_id, q, explain, printed);
+    if (shards->n == 0)
+        rc = query_file(fd, DB_FILE, MIN_STD_ID, MAX_STD_ID, q, explain, printed);
+    return rc;
+}
@@ -0,0 +1,71 @@
+#ifndef __SDB_QUERY_H__
+    #define __SDB_QUERY_H__
+
+#include <stdbool.h>
+
+#include "db.h"
+#include "sdb_shard.h"
+
+//Ad hoc queries (-q).  A query is the AND of any of
+//
+//      id=N            id=LO-HI
+//      gpa=N           gpa=LO-HI       (3 digit ints, as for -a)
+//      fname=NAME      fname=PREFIX*
+//      lname=NAME      lname=PREFIX*
+//
+//For every database file the planner picks the access path that reads the
+//fewest records:
+//
+//      empty   nothing can match: the id range misses the file, or both
+//              names are exact and the name filter (sdb_bloom.h) rules the
+//              name out
+//      direct  one id, one slot (or directory entry) read
+//      range   only the slots of the id range are read
+//      scan    full scan_db(), when the id range covers more records than
+//              the file holds
+//
+//The statistics are the file itself: its allocated size for the slot
+//format (scans skip holes), the header's record count and id bounds for
+//the compact format, and the shard bounds of a sharded database.  Every
+//predicate is still checked on each record read.  --explain prints the
+//plan of each file instead of running the query.
+#define QPLAN_EMPTY         0
+#define QPLAN_DIRECT        1
+#define QPLAN_RANGE         2
+#define QPLAN_SCAN          3
+
+typedef struct query
+{
+    int id_lo;
+    int id_hi;
+    int gpa_lo;
+    int gpa_hi;
+    char fname[24];     //"" matches any name
+    char lname[32];
+    bool fname_prefix;
+    bool lname_prefix;
+} query_t;
+
+typedef struct query_plan
+{
+    int access;         //QPLAN_*
+    int lo;             //ids read by direct and range
+    int hi;
+    long cost;          //records the access path reads
+    long scan_cost;     //records a full scan reads
+    const char *why;    //reason for an empty plan
+} query_plan_t;
+
+#define M_QUERY_NONE        "No students match the query.\n"
+#define M_QPLAN_EMPTY       "%s: empty, %s.\n"
+#define M_QPLAN_DIRECT      "%s: direct read of id %d.\n"
+#define M_QPLAN_RANGE       "%s: range read of ids %d-%d, %ld record(s) (full scan %ld).\n"
+#define M_QPLAN_SCAN        "%s: full scan, %ld record(s) (range read %ld).\n"
+
+//prototypes for sdb_query.c
+int parse_query(char **terms, int nterms, query_t *q, bool *explain);
+int plan_query(int fd, const char *dbFile, int min_id, int max_id, const query_t *q,
+               query_plan_t *p);
+int run_query(int fd, shard_set_t *shards, const query_t *q, bool explain, int *printed);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <poll.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_cache.h"
+#include "sdb_compact.h"
+#include "sdb_log.h"
+#include "sdb_session.h"
+#include "sdb_shard.h"
+
+#define SESSION_MAX_ARGS    6
+#define SESSION_DELIM       " \t\r\n"
+
+/*
+ *  session_fd
+ *
+ *  The fd point operations on id use.  For a sharded database that is the
+ *  owning shard, ids outside the valid range go to the first shard so the
+ *  usual range checks report them.
+ *
+ *  returns:  the fd, or -1 (with M_ERR_SHARD_NONE printed) if a valid id is
+ *            not covered by any shard
+ */
+static int session_fd(int fd, shard_set_t *shards, int id)
+{
+    shard_t *sh;
+
+    if (shards->n == 0)
+        return fd;
+
+    sh = shard_for_id(shards, id);
+    if (sh != NULL)
+        return sh->fd;
+    if (validate_range(id, MIN_STD_GPA) == NO_ERROR)
+    {
+        printf(M_ERR_SHARD_NONE, id);
+        return -1;
+    }
+    return shards->shards[0].fd;
+}
+
+//true if reading in will not block, input is waiting or it is at EOF
+static bool input_ready(FILE *in)
+{
+    struct pollfd p = {fileno(in), POLLIN, 0};
+
+    return poll(&p, 1, 0) > 0;
+}
+
+static int session_add(int fd, int id, char *fname, char *lname, int gpa)
+{
+    int rc;
+
+    if (validate_range(id, gpa) != NO_ERROR)
+    {
+        printf(M_ERR_STD_RNG);
+        return ERR_DB_OP;
+    }
+
+    rc = log_begin(fd);
+    if (rc == NO_ERROR)
+        rc = add_student(fd, id, fname, lname, gpa);
+    log_end(fd);
+    return rc;
+}
+
+static int session_find(int fd, int id)
+{
+    student_t student = {0};
+    int rc = get_student(fd, id, &student);
+
+    switch (rc)
+    {
+    case NO_ERROR:
+        print_student(&student);
+        break;
+    case SRCH_NOT_FOUND:
+        printf(M_STD_NOT_FND_MSG, id);
+        break;
+    default:
+        printf(M_ERR_DB_READ);
+        break;
+    }
+    return rc;
+}
+
+static int session_del(int fd, int id)
+{
+    int rc = log_begin(fd);
+
+    if (rc == NO_ERROR)
+        rc = del_student(fd, id);
+    log_end(fd);
+    return rc;
+}
+
+/*
+ *  run_session
+ *      fd:        linux file descriptor of the database, -1 if sharded
+ *      shards:    the open shards of a sharded database, n is 0 otherwise
+ *      in:        stream the commands are read from
+ *      cache_kb:  slot cache budget in KiB, 0 for no cache
+ *
+ *  Runs the commands read from in until quit or end of input, see
+ *  sdb_session.h for the command set.  A failed command is reported the
+ *  same way the matching command line option reports it and the session
+ *  carries on.
+ *
+ *  returns:  NO_ERROR       every command ran, even if some failed logically
+ *            ERR_DB_FILE    at least one command hit a database file error
+ *
+ *  console:  the output of each command, M_ERR_SESSION_CMD for a line that
+ *            is not a valid command
+ */
+int run_session(int fd, shard_set_t *shards, FILE *in, int cache_kb)
+{
+    char line[SESSION_LINE_MAX];
+    char *argv[SESSION_MAX_ARGS];
+    bool interactive = isatty(fileno(in));
+    bool any_compact = (fd >= 0 && db_is_compact(fd));
+    int result = NO_ERROR;
+
+    // the cache reads slot format pages, compact databases bypass it
+    for (int i = 0; i < shards->n; i++)
+        any_compact = any_compact || db_is_compact(shards->shards[i].fd);
+    if (cache_kb > 0 && !any_compact && cache_init(cache_kb) != NO_ERROR)
+        return ERR_DB_OP;
+
+    // output goes out in big blocks, unless a person is typing commands
+    if (!interactive)
+        setvbuf(stdout, NULL, _IOFBF, SESSION_OUT_BUF);
+
+    for (;;)
+    {
+        int argc = 0;
+        int rc = NO_ERROR;
+        char *tok;
+
+        if (interactive)
+        {
+            printf("sdb> ");
+            fflush(stdout);
+        }
+        else if (!input_ready(in))
+            fflush(stdout);
+        if (fgets(line, sizeof(line), in) == NULL)
+            break;
+
+        for (tok = strtok(line, SESSION_DELIM); tok != NULL && argc < SESSION_MAX_ARGS;
+             tok = strtok(NULL, SESSION_DELIM))
+            argv[argc++] = tok;
+        if (argc == 0 || argv[0][0] == '#')
+            continue;
+
+        if (strcmp(argv[0], "quit") == 0 || strcmp(argv[0], "exit") == 0)
+            break;
+
+        // another process may have swapped in a new file (-x) since the
+        // last command, reads must not stay on the old one
+        if (fd >= 0 && log_follow(fd) != NO_ERROR)
+            result = ERR_DB_FILE;
+        for (int i = 0; i < shards->n; i++)
+            if (log_follow(shards->shards[i].fd) != NO_ERROR)
+                result = ERR_DB_FILE;
+
+        // drop the cached pages other processes changed since the last
+        // command, the lookups of this one do not check again
+        cache_sync();
+
+        if (strcmp(argv[0], "add") == 0 && argc == 5)
+        {
+            int id = atoi(argv[1]);
+            int sfd = session_fd(fd, shards, id);
+            if (sfd >= 0)
+                rc = session_add(sfd, id, argv[2], argv[3], atoi(argv[4]));
+        }
+        else if (strcmp(argv[0], "find") == 0 && argc == 2)
+        {
+            int id = atoi(argv[1]);
+            int sfd = session_fd(fd, shards, id);
+            if (sfd >= 0)
+                rc = session_find(sfd, id);
+        }
+        else if (strcmp(argv[0], "del") == 0 && argc == 2)
+        {
+            int id = atoi(argv[1]);
+            int sfd = session_fd(fd, shards, id);
+            if (sfd >= 0)
+                rc = session_del(sfd, id);
+        }
+        else if (strcmp(argv[0], "count") == 0 && argc == 1)
+            rc = (shards->n > 0) ? count_shards(shards) : count_db_records(fd);
+        else if (strcmp(argv[0], "print") == 0 && argc == 1)
+            rc = (shards->n > 0) ? print_shards(shards) : print_db(fd);
+        else if (strcmp(argv[0], "stats") == 0 && argc == 1)
+            cache_stats();
+        else
+            printf(M_ERR_SESSION_CMD, argv[0]);
+
+        if (rc == ERR_DB_FILE)
+            result = ERR_DB_FILE;
+    }
+
+    fflush(stdout);
+    cache_free();
+    return result;
+}
@@ -0,0 +1,36 @@
+#ifndef __SDB_SESSION_H__
+    #define __SDB_SESSION_H__
+
+#include <stdio.h>
+
+#include "db.h"
+#include "sdb_shard.h"
+
+//Session mode (-i).  Commands are read one per line from stdin against a
+//database that stays open for the whole session:
+//
+//      add id first_name last_name gpa
+//      find id
+//      del id
+//      count
+//      print
+//      stats           slot cache hit/miss counters, see sdb_cache.h
+//      quit
+//
+//Blank lines and lines starting with # are ignored.  Output is written in
+//SESSION_OUT_BUF sized blocks unless stdin is a terminal, then it is
+//flushed before every prompt for the next command.  Otherwise it is also
+//flushed whenever no more input is waiting, so a program that drives the
+//session over a pipe gets its answers before it sends the next command.
+//
+//Point lookups go through the slot cache with the budget given to
+//run_session(), 0 turns it off.  Compact databases are never cached.
+#define SESSION_LINE_MAX    256
+#define SESSION_OUT_BUF     (64*1024)
+
+#define M_ERR_SESSION_CMD   "Unknown or malformed command: %s\n"
+
+//prototypes for sdb_session.c
+int run_session(int fd, shard_set_t *shards, FILE *in, int cache_kb);
+
+#endif
@@ -0,0 +1,596 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_sort.h"
+#include "sdb_bloom.h"
+#include "sdb_log.h"
+#include "sdb_shard.h"
+
+static int compare_shards(const void *pa, const void *pb)
+{
+    const shard_t *a = pa;
+    const shard_t *b = pb;
+
+    return (a->min_id > b->min_id) - (a->min_id < b->min_id);
+}
+
+/*
+ *  load_shards
+ *      manifest:  name of the shard manifest file
+ *      *set:      filled in with the shards, ordered by id range
+ *
+ *  returns:  <number>       number of shards, 0 if there is no manifest
+ *                           and the database is a single DB_FILE
+ *            ERR_DB_FILE    the manifest is unreadable or invalid
+ *
+ *  console:  Does not produce any console I/O
+ */
+int load_shards(const char *manifest, shard_set_t *set)
+{
+    char line[PATH_BUF_SZ + 64];
+    FILE *f;
+
+    set->n = 0;
+    if ((f = fopen(manifest, "r")) == NULL)
+        return (errno == ENOENT) ? 0 : ERR_DB_FILE;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        shard_t *sh = &set->shards[set->n];
+        char *p = line + strspn(line, " \t");
+
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+
+        if (set->n == SHARD_MAX ||
+            sscanf(p, "%d %d %4095s", &sh->min_id, &sh->max_id, sh->path) != 3 ||
+            sh->min_id < MIN_STD_ID || sh->max_id > MAX_STD_ID ||
+            sh->min_id > sh->max_id)
+        {
+            fclose(f);
+            set->n = 0;
+            return ERR_DB_FILE;
+        }
+        sh->fd = -1;
+        set->n++;
+    }
+    fclose(f);
+
+    // ranges must not overlap, otherwise routing is ambiguous
+    qsort(set->shards, set->n, sizeof(shard_t), compare_shards);
+    for (int i = 1; i < set->n; i++)
+    {
+        if (set->shards[i].min_id <= set->shards[i - 1].max_id)
+        {
+            set->n = 0;
+            return ERR_DB_FILE;
+        }
+    }
+
+    return set->n;
+}
+
+/*
+ *  open_shards
+ *
+ *  Opens (creating if needed) the database file of every shard.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  M_ERR_DB_OPEN if a shard cant be opened
+ */
+int open_shards(shard_set_t *set)
+{
+    for (int i = 0; i < set->n; i++)
+    {
+        set->shards[i].fd = open_db(set->shards[i].path, false);
+        if (set->shards[i].fd < 0)
+        {
+            close_shards(set);
+            return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
+
+void close_shards(shard_set_t *set)
+{
+    for (int i = 0; i < set->n; i++)
+    {
+        if (set->shards[i].fd >= 0)
+            close(set->shards[i].fd);
+        set->shards[i].fd = -1;
+    }
+}
+
+/*
+ *  shard_for_id
+ *
+ *  Binary search over the (sorted, disjoint) shard ranges.
+ *
+ *  returns:  the shard that owns id, or NULL if no shard covers it
+ */
+shard_t *shard_for_id(const shard_set_t *set, int id)
+{
+    int lo = 0, hi = set->n - 1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        const shard_t *sh = &set->shards[mid];
+
+        if (id < sh->min_id)
+            hi = mid - 1;
+        else if (id > sh->max_id)
+            lo = mid + 1;
+        else
+            return (shard_t *)sh;
+    }
+    return NULL;
+}
+
+/*
+ *  fan_out
+ *      set:     the open shards
+ *      job:     run once per shard, each on its own thread
+ *      args:    array of set->n per-shard arguments
+ *      arg_sz:  size of one entry of args
+ *
+ *  returns:  NO_ERROR, or the first error returned by a job
+ */
+typedef int (*shard_job_fn)(shard_t *sh, void *arg);
+
+typedef struct shard_thread
+{
+    pthread_t tid;
+    shard_job_fn job;
+    shard_t *sh;
+    void *arg;
+    int rc;
+    bool started;
+} shard_thread_t;
+
+static void *shard_thread_main(void *p)
+{
+    shard_thread_t *t = p;
+
+    t->rc = t->job(t->sh, t->arg);
+    return NULL;
+}
+
+static int fan_out(shard_set_t *set, shard_job_fn job, void *args, size_t arg_sz)
+{
+    shard_thread_t threads[SHARD_MAX];
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < set->n; i++)
+    {
+        shard_thread_t *t = &threads[i];
+
+        t->job = job;
+        t->sh = &set->shards[i];
+        t->arg = (char *)args + i * arg_sz;
+        t->started = (pthread_create(&t->tid, NULL, shard_thread_main, t) == 0);
+
+        // could not get a thread, just do this shard inline
+        if (!t->started)
+            shard_thread_main(t);
+    }
+
+    for (int i = 0; i < set->n; i++)
+    {
+        if (threads[i].started)
+            pthread_join(threads[i].tid, NULL);
+        if (rc == NO_ERROR && threads[i].rc != NO_ERROR)
+            rc = threads[i].rc;
+    }
+
+    return rc;
+}
+
+static int count_job(shard_t *sh, void *arg)
+{
+    return scan_db(sh->fd, count_record, arg);
+}
+
+/*
+ *  count_shards
+ *
+ *  Sharded count_db_records(), the shards are counted in parallel.
+ *
+ *  returns:  <number>       number of records in all shards
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  same as count_db_records()
+ */
+int count_shards(shard_set_t *set)
+{
+    int counts[SHARD_MAX] = {0};
+    int total = 0;
+
+    if (fan_out(set, count_job, counts, sizeof(int)) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    for (int i = 0; i < set->n; i++)
+        total += counts[i];
+
+    if (total == 0)
+        printf(M_DB_EMPTY);
+    else
+        printf(M_DB_RECORD_CNT, total);
+
+    return total;
+}
+
+//per shard print.  The rows are formatted into a ring of PRINT_BLOCKS
+//blocks that the printer thread writes out, see print_shards()
+typedef struct print_block
+{
+    size_t len;
+    char text[PRINT_BLOCK_SZ];
+} print_block_t;
+
+typedef struct print_out
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    print_block_t *blocks;  //PRINT_BLOCKS of them
+    int head;               //next full block for the printer
+    int ready;              //full blocks the printer has not taken yet
+    int fill;               //block the scan is filling, head + ready
+    bool done;              //the scan is over and its last block is ready
+} print_out_t;
+
+//hands the block being filled to the printer, then waits for a free one
+static void print_publish(print_out_t *out, bool last)
+{
+    pthread_mutex_lock(&out->lock);
+    if (out->blocks[out->fill].len > 0)
+        out->ready++;
+    out->done = last;
+    pthread_cond_broadcast(&out->cond);
+    while (!last && out->ready == PRINT_BLOCKS)
+        pthread_cond_wait(&out->cond, &out->lock);
+    pthread_mutex_unlock(&out->lock);
+
+    if (!last && out->blocks[out->fill].len > 0)
+    {
+        out->fill = (out->fill + 1) % PRINT_BLOCKS;
+        out->blocks[out->fill].len = 0;
+    }
+}
+
+static int print_row(const student_t *s, void *ctx)
+{
+    print_out_t *out = ctx;
+    print_block_t *b = &out->blocks[out->fill];
+    float gpa = s->gpa / 100.0;
+    char line[128];
+    int n;
+
+    n = snprintf(line, sizeof(line), STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
+    if (n < 0 || n >= (int)sizeof(line))
+        return ERR_DB_FILE;
+    if (b->len + n > PRINT_BLOCK_SZ)
+    {
+        print_publish(out, false);
+        b = &out->blocks[out->fill];
+    }
+    memcpy(b->text + b->len, line, n);
+    b->len += n;
+    return NO_ERROR;
+}
+
+static int print_job(shard_t *sh, void *arg)
+{
+    print_out_t *out = arg;
+    int rc = scan_db(sh->fd, print_row, out);
+
+    print_publish(out, true);
+    return rc;
+}
+
+//the printer thread: the full blocks of every shard in turn, which is id
+//order because the shard ranges are sorted and disjoint
+typedef struct printer
+{
+    print_out_t *outs;
+    int n;
+    bool header_printed;
+} printer_t;
+
+static void *printer_main(void *p)
+{
+    printer_t *pr = p;
+
+    for (int i = 0; i < pr->n; i++)
+    {
+        print_out_t *out = &pr->outs[i];
+
+        for (;;)
+        {
+            bool drained;
+
+            pthread_mutex_lock(&out->lock);
+            while (out->ready == 0 && !out->done)
+                pthread_cond_wait(&out->cond, &out->lock);
+            drained = (out->ready == 0);
+            pthread_mutex_unlock(&out->lock);
+            if (drained)
+                break;
+
+            if (!pr->header_printed)
+            {
+                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+                pr->header_printed = true;
+            }
+            fwrite(out->blocks[out->head].text, 1, out->blocks[out->head].len, stdout);
+
+            pthread_mutex_lock(&out->lock);
+            out->head = (out->head + 1) % PRINT_BLOCKS;
+            out->ready--;
+            pthread_cond_broadcast(&out->cond);
+            pthread_mutex_unlock(&out->lock);
+        }
+    }
+    return NULL;
+}
+
+//print_shards() without a printer thread, one shard after the other
+static int print_row_direct(const student_t *s, void *ctx)
+{
+    bool *header_printed = ctx;
+
+    if (!*header_printed)
+    {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+        *header_printed = true;
+    }
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, s->gpa / 100.0);
+    return NO_ERROR;
+}
+
+/*
+ *  print_shards
+ *
+ *  Sharded print_db().  Each shard is scanned and formatted on its own
+ *  thread into a ring of PRINT_BLOCKS fixed size blocks, and a printer
+ *  thread writes the blocks out shard by shard in id order.  A shard that
+ *  is not being printed yet stops when its ring is full, so the rows held
+ *  in memory never exceed PRINT_BLOCKS blocks per shard however big the
+ *  shards are.  If the threads cannot be had the shards are printed one
+ *  after the other.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  same as print_db()
+ */
+int print_shards(shard_set_t *set)
+{
+    print_out_t outs[SHARD_MAX];
+    printer_t pr = {outs, set->n, false};
+    pthread_t printer;
+    int rc = NO_ERROR;
+    int i;
+
+    for (i = 0; i < set->n; i++)
+    {
+        memset(&outs[i], 0, sizeof(outs[i]));
+        if ((outs[i].blocks = malloc(PRINT_BLOCKS * sizeof(print_block_t))) == NULL)
+            break;
+        outs[i].blocks[0].len = 0;
+        pthread_mutex_init(&outs[i].lock, NULL);
+        pthread_cond_init(&outs[i].cond, NULL);
+    }
+
+    if (i == set->n && pthread_create(&printer, NULL, printer_main, &pr) == 0)
+    {
+        rc = fan_out(set, print_job, outs, sizeof(print_out_t));
+        pthread_join(printer, NULL);
+    }
+    else
+    {
+        for (int j = 0; j < set->n && rc == NO_ERROR; j++)
+            rc = scan_db(set->shards[j].fd, print_row_direct, &pr.header_printed);
+    }
+
+    while (--i >= 0)
+    {
+        pthread_cond_destroy(&outs[i].cond);
+        pthread_mutex_destroy(&outs[i].lock);
+        free(outs[i].blocks);
+    }
+
+    if (rc == NO_ERROR && !pr.header_printed)
+        printf(M_DB_EMPTY);
+
+    return rc;
+}
+
+static int top_k_job(shard_t *sh, void *arg)
+{
+    return scan_db(sh->fd, topk_offer, arg);
+}
+
+/*
+ *  top_k_shards
+ *
+ *  Sharded print_top_k().  Every shard fills its own bounded heap in
+ *  parallel, then the (at most k * shards) per-shard winners are offered
+ *  to one final heap.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  same as print_top_k()
+ */
+int top_k_shards(shard_set_t *set, int k, int key)
+{
+    topk_heap_t heaps[SHARD_MAX] = {0};
+    topk_heap_t final;
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < set->n && rc == NO_ERROR; i++)
+        rc = topk_init(&heaps[i], k, key);
+
+    if (rc == NO_ERROR)
+        rc = fan_out(set, top_k_job, heaps, sizeof(topk_heap_t));
+
+    if (rc == NO_ERROR && (rc = topk_init(&final, k, key)) == NO_ERROR)
+    {
+        for (int i = 0; i < set->n; i++)
+            for (int j = 0; j < heaps[i].n; j++)
+                topk_offer(&heaps[i].recs[j], &final);
+
+        topk_print(&final);
+        topk_free(&final);
+    }
+
+    for (int i = 0; i < set->n; i++)
+        topk_free(&heaps[i]);
+
+    return rc;
+}
+
+//scan_db() callback for create_shards(), copies a record to its shard
+static int move_to_shard(const student_t *s, void *ctx)
+{
+    shard_set_t *set = ctx;
+    shard_t *sh = shard_for_id(set, s->id);
+    off_t offset = (off_t)s->id * sizeof(student_t);
+
+    if (sh == NULL || pwrite(sh->fd, s, sizeof(student_t), offset) != sizeof(student_t))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  create_shards
+ *      nshards:  number of shards to split the id range into
+ *      dirs:     directories to place the shard files in, round robin
+ *      ndirs:    number of entries in dirs, 0 means the current directory
+ *
+ *  Splits [MIN_STD_ID, MAX_STD_ID] into nshards equal ranges, writes the
+ *  shard manifest and moves any records already in DB_FILE into their
+ *  shards.  DB_FILE, its name filter and its change log are removed once
+ *  every shard has been synced and the manifest is in place.  All of that
+ *  runs under the change log lock of DB_FILE, so no concurrent add or
+ *  delete is lost.
+ *
+ *  returns:  <number>       number of records moved
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      the database is already sharded
+ *
+ *  console:  M_DB_SHARDED_OK       on success
+ *            M_ERR_SHARD_EXISTS    if there already is a shard manifest
+ *            M_ERR_DB_OPEN         a shard file could not be created
+ *            M_ERR_DB_WRITE        error writing the manifest or shards
+ */
+int create_shards(int nshards, char **dirs, int ndirs)
+{
+    char *here = ".";
+    char tmp[PATH_BUF_SZ];
+    shard_set_t set = {0};
+    int span = (MAX_STD_ID - MIN_STD_ID + 1) / nshards;
+    int moved = 0;
+    int fd;
+    int rc = NO_ERROR;
+    FILE *f;
+
+    if (access(SHARD_MANIFEST, F_OK) == 0)
+    {
+        printf(M_ERR_SHARD_EXISTS);
+        return ERR_DB_OP;
+    }
+    if (ndirs == 0)
+    {
+        dirs = &here;
+        ndirs = 1;
+    }
+
+    set.n = nshards;
+    for (int i = 0; i < nshards; i++)
+    {
+        shard_t *sh = &set.shards[i];
+
+        sh->min_id = MIN_STD_ID + i * span;
+        sh->max_id = (i == nshards - 1) ? MAX_STD_ID : sh->min_id + span - 1;
+        snprintf(sh->path, sizeof(sh->path), SHARD_FILE_FMT, dirs[i % ndirs], i);
+        sh->fd = -1;
+    }
+    if (open_shards(&set) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    // move over whatever is in the unsharded database.  Its change log lock
+    // is held until the database is gone, so a writer either finishes before
+    // the records are read or finds the file removed, see log_follow()
+    if ((fd = open(DB_FILE, O_RDONLY)) >= 0)
+    {
+        if (log_attach(fd, DB_FILE) != NO_ERROR)
+        {
+            close(fd);
+            fd = -1;
+            rc = ERR_DB_FILE;
+        }
+        else if ((rc = log_begin(fd)) == NO_ERROR)
+        {
+            rc = scan_db(fd, count_record, &moved);
+            if (rc == NO_ERROR)
+                rc = scan_db(fd, move_to_shard, &set);
+        }
+    }
+    for (int i = 0; i < set.n && rc == NO_ERROR; i++)
+    {
+        if (fsync(set.shards[i].fd) == -1)
+            rc = ERR_DB_FILE;
+    }
+    close_shards(&set);
+
+    // write the manifest to a temp file and rename it into place so a
+    // half written manifest is never seen
+    tmp_db_path(SHARD_MANIFEST, tmp, sizeof(tmp));
+    if (rc == NO_ERROR && (f = fopen(tmp, "w")) == NULL)
+        rc = ERR_DB_FILE;
+    else if (rc == NO_ERROR)
+    {
+        fprintf(f, "# min_id max_id path\n");
+        for (int i = 0; i < set.n; i++)
+            fprintf(f, "%d %d %s\n", set.shards[i].min_id, set.shards[i].max_id,
+                    set.shards[i].path);
+        bool written = (fflush(f) == 0 && fsync(fileno(f)) == 0);
+        if (fclose(f) != 0 || !written || rename(tmp, SHARD_MANIFEST) == -1)
+        {
+            unlink(tmp);
+            rc = ERR_DB_FILE;
+        }
+    }
+
+    if (rc == NO_ERROR)
+    {
+        unlink(DB_FILE);
+        unlink(DB_FILE BLOOM_FILE_SUFFIX);
+        unlink(DB_FILE LOG_FILE_SUFFIX);
+    }
+    if (fd >= 0)
+    {
+        // detaching closes the log, which drops its lock
+        log_detach(fd);
+        close(fd);
+    }
+
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    printf(M_DB_SHARDED_OK, nshards, moved);
+    return moved;
+}
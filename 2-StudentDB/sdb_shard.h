@@ -0,0 +1,55 @@
+#ifndef __SDB_SHARD_H__
+    #define __SDB_SHARD_H__
+
+#include "db.h"
+#include "sdbsc.h"
+
+//Sharded databases.  When a shard manifest exists in the current directory
+//the database is split by id range over several database files instead of
+//the single DB_FILE.  Every line of the manifest is
+//
+//      <min_id> <max_id> <path>
+//
+//and the ranges may not overlap.  Each shard is an ordinary slot format
+//database (records still live at id * sizeof(student_t)), so the paths can
+//point at different directories or disks.  Lines starting with # are
+//comments.
+#define SHARD_MANIFEST      "student.shards"
+#define SHARD_MAX           64
+#define SHARD_FILE_FMT      "%s/student.%d.db"  //dir, shard number
+
+//a sharded print (-p) formats each shard into at most PRINT_BLOCKS blocks
+//of PRINT_BLOCK_SZ bytes ahead of the output, see print_shards()
+#define PRINT_BLOCK_SZ      (64 * 1024)
+#define PRINT_BLOCKS        2
+
+typedef struct shard
+{
+    int min_id;
+    int max_id;
+    int fd;
+    char path[PATH_BUF_SZ];
+} shard_t;
+
+typedef struct shard_set
+{
+    int n;                  //0 means the database is not sharded
+    shard_t shards[SHARD_MAX];
+} shard_set_t;
+
+#define M_ERR_SHARD_MANIFEST "Error reading shard manifest " SHARD_MANIFEST ", exiting!\n"
+#define M_ERR_SHARD_EXISTS   "Database is already sharded, see " SHARD_MANIFEST ".\n"
+#define M_ERR_SHARD_NONE     "Student %d is not in the id range of any shard.\n"
+#define M_DB_SHARDED_OK      "Database split into %d shard(s), %d record(s) moved.\n"
+
+//prototypes for sdb_shard.c
+int load_shards(const char *manifest, shard_set_t *set);
+int open_shards(shard_set_t *set);
+void close_shards(shard_set_t *set);
+shard_t *shard_for_id(const shard_set_t *set, int id);
+int create_shards(int nshards, char **dirs, int ndirs);
+int count_shards(shard_set_t *set);
+int print_shards(shard_set_t *set);
+int top_k_shards(shard_set_t *set, int k, int key);
+
+#endif
@@ -0,0 +1,526 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdb_sort.h"
+
+/*
+ *  Sorting works on an array of small sort entries rather than on the 64
+ *  byte records themselves.  Each entry holds an 8 byte key prefix (the
+ *  first 8 characters of the name packed big endian, or the gpa) and the
+ *  index of the record in the run buffer.  Almost all comparisons are
+ *  decided by the prefix, so qsort only touches the compact entry array
+ *  and the records never move.
+ */
+typedef struct sort_ent
+{
+    uint64_t prefix;
+    uint32_t idx;
+} sort_ent_t;
+
+//one in-memory run, sized from the memory budget
+typedef struct sort_run
+{
+    student_t *recs;
+    sort_ent_t *ents;
+    int n;
+    int cap;
+    int key;
+    bool desc;
+    FILE **spills;      //sorted runs that have been written to temp files
+    int n_spills;
+} sort_run_t;
+
+//qsort() has no context argument, so the run being sorted is parked here
+static const sort_run_t *cur_run;
+
+/*
+ *  parse_sort_key
+ *      name:  the value given to --sort=
+ *
+ *  returns:  SORT_BY_* constant, or ERR_DB_OP if name is not a sort key
+ */
+int parse_sort_key(const char *name)
+{
+    if (strcmp(name, "lname") == 0)
+        return SORT_BY_LNAME;
+    if (strcmp(name, "fname") == 0)
+        return SORT_BY_FNAME;
+    if (strcmp(name, "gpa") == 0)
+        return SORT_BY_GPA;
+    if (strcmp(name, "id") == 0)
+        return SORT_BY_ID;
+    return ERR_DB_OP;
+}
+
+static uint64_t name_prefix(const char *name, size_t len)
+{
+    uint64_t prefix = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(prefix) && i < len && name[i] != '\0'; i++)
+        prefix = (prefix << 8) | (unsigned char)name[i];
+    for (; i < sizeof(prefix); i++)
+        prefix <<= 8;
+
+    return prefix;
+}
+
+static uint64_t key_prefix(const student_t *s, int key)
+{
+    switch (key)
+    {
+    case SORT_BY_LNAME:
+        return name_prefix(s->lname, sizeof(s->lname));
+    case SORT_BY_FNAME:
+        return name_prefix(s->fname, sizeof(s->fname));
+    case SORT_BY_GPA:
+        return (uint64_t)s->gpa;
+    default:
+        return (uint64_t)s->id;
+    }
+}
+
+/*
+ *  compare_students
+ *      a, b:  the two records to order
+ *      key:   SORT_BY_* constant
+ *      desc:  reverse the order of the key
+ *
+ *  Names are compared as fixed width fields so unterminated names cant
+ *  run off the end of the record.  Ties are always broken by ascending
+ *  id so the output order is deterministic.
+ *
+ *  returns:  <0, 0 or >0 like strcmp()
+ */
+int compare_students(const student_t *a, const student_t *b, int key, bool desc)
+{
+    int cmp = 0;
+
+    switch (key)
+    {
+    case SORT_BY_LNAME:
+        cmp = strncmp(a->lname, b->lname, sizeof(a->lname));
+        if (cmp == 0)
+            cmp = strncmp(a->fname, b->fname, sizeof(a->fname));
+        break;
+    case SORT_BY_FNAME:
+        cmp = strncmp(a->fname, b->fname, sizeof(a->fname));
+        if (cmp == 0)
+            cmp = strncmp(a->lname, b->lname, sizeof(a->lname));
+        break;
+    case SORT_BY_GPA:
+        cmp = (a->gpa > b->gpa) - (a->gpa < b->gpa);
+        break;
+    case SORT_BY_ID:
+        cmp = (a->id > b->id) - (a->id < b->id);
+        break;
+    }
+
+    if (desc)
+        cmp = -cmp;
+    if (cmp == 0)
+        cmp = (a->id > b->id) - (a->id < b->id);
+
+    return cmp;
+}
+
+static int compare_ents(const void *pa, const void *pb)
+{
+    const sort_ent_t *a = pa;
+    const sort_ent_t *b = pb;
+
+    if (a->prefix != b->prefix)
+    {
+        int cmp = (a->prefix > b->prefix) ? 1 : -1;
+        return cur_run->desc ? -cmp : cmp;
+    }
+
+    return compare_students(&cur_run->recs[a->idx], &cur_run->recs[b->idx],
+                            cur_run->key, cur_run->desc);
+}
+
+static void sort_current_run(sort_run_t *run)
+{
+    cur_run = run;
+    qsort(run->ents, run->n, sizeof(sort_ent_t), compare_ents);
+    cur_run = NULL;
+}
+
+/*
+ *  spill_run
+ *
+ *  Sorts the in-memory run and writes the records out in sorted order to
+ *  an anonymous temp file (tmpfile() unlinks it immediately, so nothing is
+ *  left behind if we crash).  The run buffer is then reused.
+ */
+static int spill_run(sort_run_t *run)
+{
+    FILE **spills = realloc(run->spills, (run->n_spills + 1) * sizeof(FILE *));
+    FILE *tmp;
+
+    if (spills == NULL)
+        return ERR_DB_FILE;
+    run->spills = spills;
+
+    if ((tmp = tmpfile()) == NULL)
+        return ERR_DB_FILE;
+
+    sort_current_run(run);
+    for (int i = 0; i < run->n; i++)
+    {
+        if (fwrite(&run->recs[run->ents[i].idx], sizeof(student_t), 1, tmp) != 1)
+        {
+            fclose(tmp);
+            return ERR_DB_FILE;
+        }
+    }
+    if (fflush(tmp) != 0 || fseek(tmp, 0, SEEK_SET) != 0)
+    {
+        fclose(tmp);
+        return ERR_DB_FILE;
+    }
+
+    run->spills[run->n_spills++] = tmp;
+    run->n = 0;
+    return NO_ERROR;
+}
+
+//scan_db() callback, adds a live record to the current run
+static int collect_record(const student_t *s, void *ctx)
+{
+    sort_run_t *run = ctx;
+
+    if (run->n == run->cap)
+    {
+        int rc = spill_run(run);
+        if (rc != NO_ERROR)
+            return rc;
+    }
+
+    memcpy(&run->recs[run->n], s, sizeof(student_t));
+    run->ents[run->n].prefix = key_prefix(s, run->key);
+    run->ents[run->n].idx = run->n;
+    run->n++;
+
+    return NO_ERROR;
+}
+
+static void print_sorted_row(const student_t *s, bool *header_printed)
+{
+    if (!*header_printed)
+    {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+        *header_printed = true;
+    }
+
+    float gpa = s->gpa / 100.0;
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
+}
+
+/*
+ *  merge_spills
+ *
+ *  k-way merge of the spilled runs.  The current head record of each run
+ *  is kept in a binary min-heap of run indexes so each output record
+ *  costs O(log k) comparisons.  A run ends at EOF, a read error ends the
+ *  whole merge with ERR_DB_FILE.
+ */
+static int merge_spills(sort_run_t *run, bool *header_printed)
+{
+    int k = run->n_spills;
+    student_t *heads = malloc(k * sizeof(student_t));
+    int *heap = malloc(k * sizeof(int));
+    int n = 0;
+    int rc = NO_ERROR;
+
+    if (heads == NULL || heap == NULL)
+    {
+        free(heads);
+        free(heap);
+        return ERR_DB_FILE;
+    }
+
+#define HEAD_LESS(x, y) (compare_students(&heads[heap[x]], &heads[heap[y]], \
+                                          run->key, run->desc) < 0)
+
+    for (int i = 0; i < k && rc == NO_ERROR; i++)
+    {
+        if (fread(&heads[i], sizeof(student_t), 1, run->spills[i]) != 1)
+        {
+            if (ferror(run->spills[i]))
+                rc = ERR_DB_FILE;
+            continue;
+        }
+
+        // sift up
+        int c = n++;
+        heap[c] = i;
+        while (c > 0 && HEAD_LESS(c, (c - 1) / 2))
+        {
+            int p = (c - 1) / 2, t = heap[p];
+            heap[p] = heap[c];
+            heap[c] = t;
+            c = p;
+        }
+    }
+
+    while (n > 0 && rc == NO_ERROR)
+    {
+        int top = heap[0];
+
+        print_sorted_row(&heads[top], header_printed);
+
+        if (fread(&heads[top], sizeof(student_t), 1, run->spills[top]) != 1)
+        {
+            if (ferror(run->spills[top]))
+                rc = ERR_DB_FILE;
+            heap[0] = heap[--n];
+        }
+
+        // sift down
+        int p = 0;
+        for (;;)
+        {
+            int l = 2 * p + 1, r = l + 1, m = p;
+            if (l < n && HEAD_LESS(l, m))
+                m = l;
+            if (r < n && HEAD_LESS(r, m))
+                m = r;
+            if (m == p)
+                break;
+            int t = heap[p];
+            heap[p] = heap[m];
+            heap[m] = t;
+            p = m;
+        }
+    }
+
+#undef HEAD_LESS
+
+    free(heads);
+    free(heap);
+    return rc;
+}
+
+/*
+ *  print_db_sorted
+ *      fds:         linux file descriptors, more than one for a sharded db
+ *      nfds:        number of entries in fds
+ *      key:         SORT_BY_* constant
+ *      desc:        print in descending order of key
+ *      mem_budget:  bytes the in-memory sort is allowed to use
+ *
+ *  Prints all records in the database in the same format as print_db()
+ *  but ordered by key.  The live records of every fd are collected with
+ *  scan_db().
+ *  If they all fit within mem_budget they are sorted in memory, otherwise
+ *  this turns into an external merge sort: each full buffer is sorted and
+ *  spilled to a temp file and the spilled runs are merged at the end.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or temp file I/O issue
+ *
+ *  console:  <see print_db()>  on success, print table or database empty
+ */
+int print_db_sorted(const int *fds, int nfds, int key, bool desc, size_t mem_budget)
+{
+    sort_run_t run = {0};
+    bool header_printed = false;
+    int rc;
+
+    run.key = key;
+    run.desc = desc;
+    run.cap = mem_budget / (sizeof(student_t) + sizeof(sort_ent_t));
+    if (run.cap < 1)
+        run.cap = 1;
+
+    run.recs = malloc(run.cap * sizeof(student_t));
+    run.ents = malloc(run.cap * sizeof(sort_ent_t));
+    if (run.recs == NULL || run.ents == NULL)
+    {
+        rc = ERR_DB_FILE;
+        goto done;
+    }
+
+    for (int i = 0; i < nfds; i++)
+    {
+        rc = scan_db(fds[i], collect_record, &run);
+        if (rc != NO_ERROR)
+            goto done;
+    }
+
+    if (run.n_spills == 0)
+    {
+        // everything fit in memory
+        sort_current_run(&run);
+        for (int i = 0; i < run.n; i++)
+            print_sorted_row(&run.recs[run.ents[i].idx], &header_printed);
+    }
+    else
+    {
+        if (run.n > 0 && (rc = spill_run(&run)) != NO_ERROR)
+            goto done;
+        rc = merge_spills(&run, &header_printed);
+    }
+
+    if (rc == NO_ERROR && !header_printed)
+        printf(M_DB_EMPTY);
+
+done:
+    for (int i = 0; i < run.n_spills; i++)
+        fclose(run.spills[i]);
+    free(run.spills);
+    free(run.recs);
+    free(run.ents);
+    return rc;
+}
+
+/*
+ *  Top-K keeps the best k records seen so far in a bounded heap whose root
+ *  is the worst of them, so a new record only has to beat the root to get
+ *  in.  "Best" means first in descending key order, ties going to the
+ *  lower id, exactly like print_db_sorted(..., desc=true).
+ */
+
+//qsort() comparator for the final ordering of the winners
+static int topk_sort_key;
+
+static int compare_topk(const void *pa, const void *pb)
+{
+    return compare_students(pa, pb, topk_sort_key, true);
+}
+
+//true if a ranks after b, aka a is worse than b
+#define TOPK_WORSE(h, a, b) (compare_students(&(h)->recs[a], &(h)->recs[b], \
+                                              (h)->key, true) > 0)
+
+static void topk_sift_down(topk_heap_t *h, int p)
+{
+    for (;;)
+    {
+        int l = 2 * p + 1, r = l + 1, m = p;
+        if (l < h->n && TOPK_WORSE(h, l, m))
+            m = l;
+        if (r < h->n && TOPK_WORSE(h, r, m))
+            m = r;
+        if (m == p)
+            break;
+
+        student_t t = h->recs[p];
+        h->recs[p] = h->recs[m];
+        h->recs[m] = t;
+        p = m;
+    }
+}
+
+/*
+ *  topk_init
+ *
+ *  returns:  NO_ERROR, or ERR_DB_FILE if the k records cant be allocated
+ */
+int topk_init(topk_heap_t *h, int k, int key)
+{
+    h->n = 0;
+    h->k = k;
+    h->key = key;
+    h->recs = malloc(k * sizeof(student_t));
+
+    return (h->recs == NULL) ? ERR_DB_FILE : NO_ERROR;
+}
+
+void topk_free(topk_heap_t *h)
+{
+    free(h->recs);
+    h->recs = NULL;
+    h->n = 0;
+}
+
+/*
+ *  topk_offer
+ *
+ *  scan_db() callback, offers one live record to the heap in ctx
+ */
+int topk_offer(const student_t *s, void *ctx)
+{
+    topk_heap_t *h = ctx;
+
+    if (h->n < h->k)
+    {
+        // heap not full yet, sift the new record up
+        int c = h->n++;
+        h->recs[c] = *s;
+        while (c > 0 && TOPK_WORSE(h, c, (c - 1) / 2))
+        {
+            int p = (c - 1) / 2;
+            student_t t = h->recs[p];
+            h->recs[p] = h->recs[c];
+            h->recs[c] = t;
+            c = p;
+        }
+    }
+    else if (compare_students(s, &h->recs[0], h->key, true) < 0)
+    {
+        // better than the worst winner so far, replace it
+        h->recs[0] = *s;
+        topk_sift_down(h, 0);
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  topk_print
+ *
+ *  Orders the winners best first and prints them in the print_db() table
+ *  format.  The heap is no longer a heap afterwards.
+ */
+void topk_print(topk_heap_t *h)
+{
+    bool header_printed = false;
+
+    topk_sort_key = h->key;
+    qsort(h->recs, h->n, sizeof(student_t), compare_topk);
+
+    for (int i = 0; i < h->n; i++)
+        print_sorted_row(&h->recs[i], &header_printed);
+    if (!header_printed)
+        printf(M_DB_EMPTY);
+}
+
+/*
+ *  print_top_k
+ *      fd:   linux file descriptor
+ *      k:    how many students to print
+ *      key:  SORT_BY_* constant to rank by, normally SORT_BY_GPA
+ *
+ *  Prints the k students with the highest key, best first, in the same
+ *  format as print_db().  This is a single scan_db() pass that feeds a
+ *  bounded heap of k records, so memory use is O(k) no matter how big the
+ *  database is.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  <see print_db()>  on success, print table or database empty
+ */
+int print_top_k(int fd, int k, int key)
+{
+    topk_heap_t h;
+    int rc;
+
+    if (topk_init(&h, k, key) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    rc = scan_db(fd, topk_offer, &h);
+    if (rc == NO_ERROR)
+        topk_print(&h);
+
+    topk_free(&h);
+    return rc;
+}
@@ -0,0 +1,44 @@
+#ifndef __SDB_SORT_H__
+    #define __SDB_SORT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "db.h"
+
+//sort keys for print_db_sorted(), selected with -p --sort=<key>
+#define SORT_BY_ID      0       //file order, what plain -p prints
+#define SORT_BY_LNAME   1       //last name, then first name
+#define SORT_BY_FNAME   2       //first name, then last name
+#define SORT_BY_GPA     3
+
+//memory budget for the in-memory sort, --mem=KB overrides it.  Once the
+//live records do not fit in the budget sorted runs are spilled to
+//temporary files and merged.
+#define SORT_DEF_MEM_KB     (16 * 1024)
+#define SORT_MIN_MEM_KB     16
+
+//largest K accepted by -t, the heap is K records so this caps it at 64MB
+#define TOPK_MAX            (1024 * 1024)
+
+//bounded heap used by the top-K query, see print_top_k().  Exposed so the
+//sharded top-K can keep one heap per shard and merge them.
+typedef struct topk_heap
+{
+    student_t *recs;
+    int n;
+    int k;
+    int key;
+} topk_heap_t;
+
+//prototypes for sdb_sort.c
+int parse_sort_key(const char *name);
+int compare_students(const student_t *a, const student_t *b, int key, bool desc);
+int print_db_sorted(const int *fds, int nfds, int key, bool desc, size_t mem_budget);
+int topk_init(topk_heap_t *h, int k, int key);
+int topk_offer(const student_t *s, void *ctx);
+void topk_print(topk_heap_t *h);
+void topk_free(topk_heap_t *h);
+int print_top_k(int fd, int k, int key);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h> //c library for system call file routines
@@ -5,10 +6,23 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <errno.h>
 
 // database include files
 #include "db.h"
 #include "sdbsc.h"
+#include "sdb_batch.h"
+#include "sdb_sort.h"
+#include "sdb_compact.h"
+#include "sdb_shard.h"
+#include "sdb_log.h"
+#include "sdb_session.h"
+#include "sdb_cache.h"
+#include "sdb_mmap.h"
+#include "sdb_bloom.h"
+#include "sdb_archive.h"
+#include "sdb_query.h"
+#include "libsdb.h"
 
 /*
  *  open_db
@@ -47,6 +61,57 @@ int open_db(char *dbFile, bool should_truncate)
     return fd;
 }
 
+/*
+ *  zero_db
+ *      fd:      fd of an open database with its change log attached
+ *      dbFile:  name of that database file
+ *
+ *  Removes every record of the database.  The file is cut to nothing,
+ *  LOG_OP_ZERO is logged and an empty name filter is put in place, all
+ *  under the change log lock (see log_begin()), so no other process adds
+ *  a student between the truncate and the new filter, and an online
+ *  compaction never swaps in its copy of the old records afterwards.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE
+ *
+ *  console:  Does not produce any console I/O
+ */
+int zero_db(int fd, const char *dbFile)
+{
+    int rc = log_begin(fd);
+
+    if (rc == NO_ERROR)
+    {
+        if (ftruncate(fd, 0) == -1 ||
+            log_event(fd, LOG_OP_ZERO, NULL) != NO_ERROR ||
+            bloom_rebuild(fd, dbFile) != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    log_end(fd);
+    return rc;
+}
+
+/*
+ *  tmp_db_path
+ *      dbFile:  name of the database file
+ *      buff:    where the temporary file name is built
+ *      len:     size of buff
+ *
+ *  Builds the name of the temporary file used while rewriting dbFile.  It
+ *  lives in the same directory as dbFile so it can be renamed over it, and
+ *  for DB_FILE itself it is TMP_DB_FILE from db.h.
+ *
+ *  console:  Does not produce any console I/O
+ */
+void tmp_db_path(const char *dbFile, char *buff, size_t len)
+{
+    const char *base = strrchr(dbFile, '/');
+    int dir_len = (base == NULL) ? 0 : (int)(base - dbFile) + 1;
+
+    base = (base == NULL) ? dbFile : base + 1;
+    snprintf(buff, len, "%.*s.tmp_%s", dir_len, dbFile, base);
+}
+
 /*
  *  get_student
  *      fd:  linux file descriptor
@@ -62,35 +127,60 @@ int open_db(char *dbFile, bool should_truncate)
  */
 int get_student(int fd, int id, student_t *s)
 {
-    student_t temp;     // Temporary student record to hold data read from the file
-    ssize_t bytes_read; // Variable to store the number of bytes read from the file
+    // one direct read of the slot of id, see libsdb.c
+    return db_get(fd, id, s);
+}
 
-    // Move the file pointer to the beginning of the file (seek offset 0 from the start)
-    if (lseek(fd, 0, SEEK_SET) == -1)
-    {
-        return ERR_DB_FILE; // Return error if seeking the file fails
-    }
+/*
+ *  print_found_student
+ *
+ *  find_many() callback used by find_students().  Prints the table header
+ *  before the first student that is found, then one row per student, or
+ *  the not found message for ids that are not in the database.
+ */
+static void print_found_student(int id, const student_t *s, void *ctx)
+{
+    bool *header_printed = ctx;
 
-    // Read the file record by record (each student record has the size of student_t)
-    while ((bytes_read = read(fd, &temp, sizeof(student_t))) == sizeof(student_t))
+    if (s == NULL)
     {
-        // Check if the current student's ID matches the requested ID
-        if (temp.id == id)
-        {
-            // If a match is found, copy the student data into the provided student pointer (s)
-            memcpy(s, &temp, sizeof(student_t));
-            return NO_ERROR; // Return success if the student is found
-        }
+        printf(M_STD_NOT_FND_MSG, id);
+        return;
     }
 
-    // If read fails or doesn't read a full record, return an error
-    if (bytes_read == -1)
+    if (!*header_printed)
     {
-        return ERR_DB_FILE; // Return error if file reading fails
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST NAME", "GPA");
+        *header_printed = true;
     }
 
-    // If the student with the requested ID was not found, return a "not found" error
-    return SRCH_NOT_FOUND;
+    float gpa = s->gpa / 100.0;
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
+}
+
+/*
+ *  find_students
+ *      fd:      linux file descriptor
+ *      shards:  the open shards if the database is sharded, or NULL
+ *      ids:     stream of whitespace separated student ids (file or stdin)
+ *      qdepth:  number of slot reads to keep in flight, see sdb_batch.h
+ *      flags:   BATCH_* flags passed through to find_many()
+ *
+ *  Batched version of -f.  Instead of one process and one lookup per id
+ *  all of the slot reads are queued on io_uring (or a pread thread pool)
+ *  and the results are printed in the order they complete.
+ *
+ *  returns:  <number>       the number of ids that were not found
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  one table row for every student found
+ *            M_STD_NOT_FND_MSG  for every id that is not in the database
+ */
+int find_students(int fd, const shard_set_t *shards, FILE *ids, int qdepth, int flags)
+{
+    bool header_printed = false;
+
+    return find_many(fd, shards, ids, qdepth, flags, print_found_student, &header_printed);
 }
 
 /*
@@ -101,10 +191,9 @@ int get_student(int fd, int id, student_t *s)
  *      lname:  student last name
  *      gpa:    GPA as an integer (range defined in db.h)
  *
- *  Adds a new student to the database.  After calculating the index for the
- *  student, check if there is another student already at that location.  A good
- *  way is to use something like memcmp() to ensure that the location for this
- *  student contains all zero byes indicating the space is empty.
+ *  Adds a new student to the database with db_add(), which writes the
+ *  student to the slot at id * sizeof(student_t) if that slot is all zero
+ *  bytes, and reports the outcome.
  *
  *  returns:  NO_ERROR       student added to database
  *            ERR_DB_FILE    database file I/O issue
@@ -120,64 +209,36 @@ int get_student(int fd, int id, student_t *s)
  */
 int add_student(int fd, int id, char *fname, char *lname, int gpa)
 {
-    student_t student;                              // Declare a student record variable to hold student data
-    student_t empty_student = EMPTY_STUDENT_RECORD; // Initialize a placeholder for an empty student record
+    student_t student = EMPTY_STUDENT_RECORD;
+    int rc;
 
-    // Validate if the ID and GPA are within an acceptable range
-    if (validate_range(id, gpa) != NO_ERROR)
-    {
-        printf("a");      // Print for debugging if validation fails
-        return ERR_DB_OP; // Return error if validation fails
-    }
-
-    // Calculate the offset in the file based on the student ID
-    off_t offset = id * sizeof(student_t);
-
-    // Move the file pointer to the correct position based on the offset
-    if (lseek(fd, offset, SEEK_SET) == -1)
-    {
-        printf("b");        // Print for debugging if seeking the file fails
-        return ERR_DB_FILE; // Return error if seeking the file fails
-    }
-
-    // Read the student record at the calculated offset into the student variable
-    ssize_t bytes_read = read(fd, &student, sizeof(student_t));
-    if (bytes_read == -1)
-    {
-        printf("c");        // Print for debugging if reading from the file fails
-        return ERR_DB_FILE; // Return error if reading the file fails
-    }
-
-    // Check if a full student record was read and it's not an empty record
-    if (bytes_read == sizeof(student_t) && memcmp(&student, &empty_student, sizeof(student_t)) != 0)
-    {
-        printf("Cant add student with ID=%d, already exists in db.\n", id); // Print error message for existing student
-        return ERR_DB_OP;                                                   // Return error for duplicate entry
-    }
-
-    // Set the student information (ID, first name, last name, GPA)
     student.id = id;
-    strncpy(student.fname, fname, sizeof(student.fname) - 1); // Copy first name (safe copy with max length)
-    strncpy(student.lname, lname, sizeof(student.lname) - 1); // Copy last name (safe copy with max length)
-    student.gpa = gpa;                                        // Set the GPA
-
-    // Move the file pointer back to the calculated offset for writing
-    if (lseek(fd, offset, SEEK_SET) == -1)
-    {
-        printf("e");        // Print for debugging if seeking the file fails
-        return ERR_DB_FILE; // Return error if seeking the file fails
-    }
-
-    // Write the updated student record to the file
-    if (write(fd, &student, sizeof(student_t)) != sizeof(student_t))
+    strncpy(student.fname, fname, sizeof(student.fname) - 1);
+    strncpy(student.lname, lname, sizeof(student.lname) - 1);
+    student.gpa = gpa;
+
+    // The write itself, with the slot cache, name filter and change log
+    // updates, lives in libsdb, see db_add()
+    rc = db_add(fd, &student);
+    switch (rc)
     {
-        printf("f");        // Print for debugging if writing to the file fails
-        return ERR_DB_FILE; // Return error if writing the file fails
+    case NO_ERROR:
+        printf(M_STD_ADDED, id);
+        return NO_ERROR;
+    case ERR_DB_READONLY:
+        printf(M_ERR_DB_COMPACT);
+        return ERR_DB_OP;
+    case ERR_DB_EXISTS:
+        printf(M_ERR_DB_ADD_DUP, id);
+        return ERR_DB_OP;
+    case ERR_DB_RANGE:
+        return ERR_DB_OP;
+    case ERR_DB_LOG:
+        printf(M_ERR_LOG_WRITE);
+        return ERR_DB_FILE;
+    default:
+        return ERR_DB_FILE;
     }
-
-    // Print a success message after the student is added
-    printf(M_STD_ADDED, id);
-    return NO_ERROR; // Return success
 }
 
 /*
@@ -185,10 +246,9 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
  *      fd:     linux file descriptor
  *      id:     student id to be deleted
  *
- *  Removes a student to the database.  Use the get_student() function to
- *  locate the student to be deleted. If there is a student at that location
- *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
- *  that location.
+ *  Removes a student from the database with db_del(), which overwrites the
+ *  student's slot with EMPTY_STUDENT_RECORD from db.h, and reports the
+ *  outcome.
  *
  *  returns:  NO_ERROR       student deleted from database
  *            ERR_DB_FILE    database file I/O issue
@@ -204,48 +264,113 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
  */
 int del_student(int fd, int id)
 {
-    student_t existing_student;                     // Declare a variable to hold the existing student data
-    student_t empty_student = EMPTY_STUDENT_RECORD; // Initialize an empty student record to mark deleted records
+    int rc = db_del(fd, id);
 
-    // Use get_student to fetch the student with the given ID from the database
-    if (get_student(fd, id, &existing_student) != NO_ERROR)
+    switch (rc)
     {
-        // If the student is not found, print an error message and return an error code
-        printf(M_STD_NOT_FND_MSG, id); // Display the student not found message
-        return ERR_DB_OP;              // Return error if student is not found
+    case NO_ERROR:
+        printf(M_STD_DEL_MSG, id);
+        return NO_ERROR;
+    case ERR_DB_READONLY:
+        printf(M_ERR_DB_COMPACT);
+        return ERR_DB_OP;
+    case SRCH_NOT_FOUND:
+        printf(M_STD_NOT_FND_MSG, id);
+        return ERR_DB_OP;
+    case ERR_DB_LOG:
+        printf(M_ERR_LOG_WRITE);
+        return ERR_DB_FILE;
+    default:
+        return ERR_DB_FILE;
     }
+}
 
-    // Now that we have the student, we want to overwrite the record with an empty student record
-    off_t offset = id * sizeof(student_t); // Calculate the offset based on the student ID
+/*
+ *  scan_db
+ *      fd:   linux file descriptor
+ *      fn:   callback invoked for every live student record
+ *      ctx:  passed through to fn
+ *
+ *  Block-read scan path.  Rather than issuing one read() per 64 byte
+ *  record, the database is pread() in SCAN_BLOCK_SZ chunks and the live
+ *  records in each chunk are handed to fn in id order.  A slot is live if
+ *  its id is not DELETED_STUDENT_ID, deleted and never used slots are all
+ *  zeros.  Holes in the (sparse) file are skipped with SEEK_DATA.  With
+ *  --mmap the file is walked through a mapping instead, see sdb_mmap.h.
+ *
+ *  returns:  NO_ERROR       every record was visited
+ *            ERR_DB_FILE    database file I/O issue
+ *            <other>        whatever fn returned to stop the scan early
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_db(int fd, scan_fn fn, void *ctx)
+{
+    student_t *block;
+    off_t offset = 0;
+    ssize_t bytes_read;
+    int rc = NO_ERROR;
+
+    if (db_is_compact(fd))
+        return compact_scan(fd, fn, ctx);
+    if (mmap_scan_flags() & MMAP_SCAN)
+        return mmap_scan(fd, fn, ctx);
+
+    block = malloc(SCAN_BLOCK_SZ);
+    if (block == NULL)
+        return ERR_DB_FILE;
 
-    // Move the file pointer to the calculated offset for the student record
-    if (lseek(fd, offset, SEEK_SET) == -1)
+    while (rc == NO_ERROR)
     {
-        return ERR_DB_FILE; // Return an error if seeking the file fails
-    }
+        // skip over holes, shard files and databases with only a few high
+        // ids are mostly holes
+        off_t data = lseek(fd, offset, SEEK_DATA);
+        if (data == -1 && errno == ENXIO)
+        {
+            bytes_read = 0; // only a hole left until EOF
+            break;
+        }
+        if (data > offset)
+            offset = data - (data % sizeof(student_t));
 
-    // Write the empty student record (indicating deletion) to the file at the given offset
-    if (write(fd, &empty_student, sizeof(student_t)) != sizeof(student_t))
-    {
-        return ERR_DB_FILE; // Return an error if writing the file fails
+        bytes_read = pread(fd, block, SCAN_BLOCK_SZ, offset);
+        if (bytes_read <= 0)
+            break;
+
+        int n = bytes_read / sizeof(student_t);
+
+        for (int i = 0; i < n && rc == NO_ERROR; i++)
+        {
+            if (block[i].id != DELETED_STUDENT_ID)
+                rc = fn(&block[i], ctx);
+        }
+        offset += bytes_read;
     }
 
-    // Print a success message confirming the student has been deleted
-    printf(M_STD_DEL_MSG, id);
-    return NO_ERROR; // Return success to indicate the operation was successful
+    if (rc == NO_ERROR && bytes_read == -1)
+        rc = ERR_DB_FILE;
+
+    free(block);
+    return rc;
+}
+
+//scan_db() callback that counts the records, ctx points at an int.  The
+//other whole database counts (sdb_count(), count_shards(), ...) use it too
+int count_record(const student_t *s, void *ctx)
+{
+    (void)s;
+    (*(int *)ctx)++;
+    return NO_ERROR;
 }
 
 /*
  *  count_db_records
  *      fd:     linux file descriptor
  *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
+ *  Counts the number of records in the database.  The records are read
+ *  with scan_db(), which reads the file in large blocks and skips empty
+ *  or previously deleted slots, so every record it hands us is counted.
+ *  This works for both the slot and the compact database formats.
  *
  *  returns:  <number>       returns the number of records in db on success
  *            ERR_DB_FILE    database file I/O issue
@@ -261,31 +386,10 @@ int del_student(int fd, int id)
  */
 int count_db_records(int fd)
 {
-    student_t student;                              // Declare a variable to hold the student data read from the file
-    student_t empty_student = EMPTY_STUDENT_RECORD; // Initialize an empty student record to compare for deleted records
-    int record_count = 0;                           // Initialize a counter for the number of valid records
-
-    off_t offset = 0;   // Start reading from the beginning of the file
-    ssize_t bytes_read; // Variable to store the number of bytes read during each read operation
-
-    // Move the file pointer to the beginning of the file
-    if (lseek(fd, offset, SEEK_SET) == -1)
-    {
-        return ERR_DB_FILE; // Return error if seeking the file fails
-    }
+    int record_count = 0; // Initialize a counter for the number of valid records
 
-    // Loop through each student record in the file
-    while ((bytes_read = read(fd, &student, sizeof(student_t))) > 0)
-    {
-        // If the student record is not empty, increment the valid record count
-        if (memcmp(&student, &empty_student, sizeof(student_t)) != 0)
-        {
-            record_count++;
-        }
-    }
-
-    // If an error occurs while reading the file, return an error
-    if (bytes_read == -1)
+    // Count every live record in the database
+    if (scan_db(fd, count_record, &record_count) != NO_ERROR)
     {
         return ERR_DB_FILE; // Return error if reading the file fails
     }
@@ -304,17 +408,33 @@ int count_db_records(int fd)
     return record_count; // Return the number of valid records found
 }
 
+//scan_db() callback for print_db(), ctx points at the first record flag
+static int print_record(const student_t *student, void *ctx)
+{
+    int *first_valid_record = ctx;
+
+    // Print the header only if this is the first valid record
+    if (*first_valid_record)
+    {
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+        *first_valid_record = 0; // Set the flag to false after printing the header
+    }
+
+    // Calculate the GPA as a float (dividing by 100 to convert it to a float representation)
+    float gpa = student->gpa / 100.0;
+
+    // Print the student information in the formatted output
+    printf(STUDENT_PRINT_FMT_STRING, student->id, student->fname, student->lname, gpa);
+    return NO_ERROR;
+}
+
 /*
  *  print_db
  *      fd:     linux file descriptor
  *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
- *  on the first real row encountered print the header for the required output:
+ *  Prints all records in the database.  The live records are read with
+ *  scan_db(), in id order, and the database might be empty.  On the first
+ *  real row encountered print the header for the required output:
  *
  *     printf(STUDENT_PRINT_HDR_STRING, "ID",
  *                  "FIRST NAME", "LAST_NAME", "GPA");
@@ -324,9 +444,7 @@ int count_db_records(int fd)
  *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
  *                    student.lname, calculated_gpa_from_student);
  *
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
+ *  Dont forget that the GPA in the student structure is an int, to convert it into a real
  *  gpa divide by 100.0 and store in a float variable.
  *
  *  returns:  NO_ERROR       on success
@@ -339,41 +457,10 @@ int count_db_records(int fd)
  */
 int print_db(int fd)
 {
-    student_t student;                              // Declare a variable to hold the student data read from the file
-    student_t empty_student = EMPTY_STUDENT_RECORD; // Initialize an empty student record to compare against
-    off_t offset = 0;                               // Start reading from the beginning of the file
-    ssize_t bytes_read;                             // Variable to store the number of bytes read during each read operation
-    int first_valid_record = 1;                     // Flag to track if the first valid record has been printed (to print the header only once)
-
-    // Seek to the beginning of the file
-    if (lseek(fd, offset, SEEK_SET) == -1)
-    {
-        return ERR_DB_FILE; // Return an error if seeking the file fails
-    }
+    int first_valid_record = 1; // Flag to track if the first valid record has been printed (to print the header only once)
 
-    // Read records one by one until EOF
-    while ((bytes_read = read(fd, &student, sizeof(student_t))) > 0)
-    {
-        // Check if the current record is not empty by comparing it with the empty student record
-        if (memcmp(&student, &empty_student, sizeof(student_t)) != 0)
-        {
-            // Print the header only if this is the first valid record
-            if (first_valid_record)
-            {
-                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
-                first_valid_record = 0; // Set the flag to false after printing the header
-            }
-
-            // Calculate the GPA as a float (dividing by 100 to convert it to a float representation)
-            float gpa = student.gpa / 100.0;
-
-            // Print the student information in the formatted output
-            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, gpa);
-        }
-    }
-
-    // Handle any read errors by checking if bytes_read is -1
-    if (bytes_read == -1)
+    // Print every live record in id order
+    if (scan_db(fd, print_record, &first_valid_record) != NO_ERROR)
     {
         return ERR_DB_FILE; // Return an error if reading the file fails
     }
@@ -435,10 +522,145 @@ void print_student(student_t *s)
 }
 
 /*
- *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
+ *  copy_range
+ *
+ *  Copies len bytes at offset from src to the same offset in dst.  The
+ *  kernel does the copy with copy_file_range() (a reflink on filesystems
+ *  that support it), falling back to pread()/pwrite() through buff when the
+ *  two files cannot be copied between directly.
+ */
+static int copy_range(int src, int dst, off_t offset, off_t len, char *buff)
+{
+    loff_t in = offset, out = offset;
+
+    while (len > 0)
+    {
+        ssize_t n = copy_file_range(src, &in, dst, &out, len, 0);
+        if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                      errno == EOPNOTSUPP))
+        {
+            n = pread(src, buff, (len < SCAN_BLOCK_SZ) ? len : SCAN_BLOCK_SZ, in);
+            if (n > 0 && pwrite(dst, buff, n, out) != n)
+                return ERR_DB_FILE;
+            in += (n > 0) ? n : 0;
+            out += (n > 0) ? n : 0;
+        }
+        if (n <= 0)
+            return ERR_DB_FILE;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  copy_live_pages
+ *
+ *  Copies every COMPRESS_PAGE_SZ page of src that holds at least one live
+ *  record to the same offset in dst.  Pages with only deleted (all zero)
+ *  records and the holes between them are skipped, so they become holes
+ *  in dst.  Neighbouring live pages are copied as one run.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE, *end is set to the end of the last
+ *            live record
+ */
+static int copy_live_pages(int src, int dst, off_t *end)
+{
+    static const char zeros[COMPRESS_PAGE_SZ];
+    char *block = malloc(SCAN_BLOCK_SZ);
+    char *buff = malloc(SCAN_BLOCK_SZ);
+    off_t offset = 0;
+    off_t run = -1; // start of the run of live pages not copied yet
+    int rc = NO_ERROR;
+
+    *end = 0;
+    if (block == NULL || buff == NULL)
+        rc = ERR_DB_FILE;
+
+    while (rc == NO_ERROR)
+    {
+        off_t data = lseek(src, offset, SEEK_DATA);
+        if (data == -1 && errno != ENXIO)
+            rc = ERR_DB_FILE;
+        if (data == -1)
+            break;
+
+        // a hole ends the current run
+        data -= data % COMPRESS_PAGE_SZ;
+        if (data != offset && run >= 0)
+        {
+            rc = copy_range(src, dst, run, offset - run, buff);
+            run = -1;
+        }
+        offset = data;
+
+        ssize_t n = pread(src, block, SCAN_BLOCK_SZ, offset);
+        if (n < 0)
+            rc = ERR_DB_FILE;
+        if (n <= 0)
+            break;
+
+        for (ssize_t pg = 0; pg < n && rc == NO_ERROR; pg += COMPRESS_PAGE_SZ)
+        {
+            size_t pg_len = (n - pg < COMPRESS_PAGE_SZ) ? n - pg : COMPRESS_PAGE_SZ;
+            if (memcmp(block + pg, zeros, pg_len) == 0)
+            {
+                if (run >= 0)
+                    rc = copy_range(src, dst, run, offset + pg - run, buff);
+                run = -1;
+                continue;
+            }
+            if (run < 0)
+                run = offset + pg;
+            for (size_t i = 0; i < pg_len; i += sizeof(student_t))
+                if (((student_t *)(block + pg + i))->id != DELETED_STUDENT_ID)
+                    *end = offset + pg + i + sizeof(student_t);
+        }
+        offset += n;
+    }
+    if (rc == NO_ERROR && run >= 0)
+        rc = copy_range(src, dst, run, offset - run, buff);
+
+    free(block);
+    free(buff);
+    return rc;
+}
+
+/*
+ *  link_db
  *
+ *  Gives the anonymous O_TMPFILE tmp_fd the name tmp, then renames it over
+ *  dbFile and syncs the directory so the swap survives a crash.
+ */
+static int link_db(int tmp_fd, bool anon, char *tmp, char *dbFile, const char *dir)
+{
+    char proc[64];
+    int dir_fd;
+
+    if (anon)
+    {
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", tmp_fd);
+        unlink(tmp);
+        if (linkat(AT_FDCWD, proc, AT_FDCWD, tmp, AT_SYMLINK_FOLLOW) == -1 &&
+            linkat(tmp_fd, "", AT_FDCWD, tmp, AT_EMPTY_PATH) == -1)
+            return ERR_DB_FILE;
+    }
+    if (rename(tmp, dbFile) == -1)
+    {
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+    if ((dir_fd = open(dir, O_RDONLY | O_DIRECTORY)) >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return NO_ERROR;
+}
+
+/*
  *  compress_db
- *      fd:     linux file descriptor
+ *      fd:      linux file descriptor
+ *      dbFile:  name of the database file
  *
  *  This assignment takes advantage of the way Linux handles sparse files
  *  on disk. Thus if there is a large hole between student records, Linux
@@ -446,46 +668,102 @@ void print_student(student_t *s)
  *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
  *  db.h - record.
  *
- *  Since Linux provides no way to delete data in the middle of a file, and
- *  deleted records take up physical storage, this function will compress the
- *  database by rewriting a new database file that only includes valid student
- *  records. There are a number of ways to do this, but since this is extra credit
- *  you need to figure this out on your own.
- *
- *  At a high level create a temporary database file then copy all valid students from
- *  the active database (passed in via fd) to the temporary file. When this is done
- *  rename the temporary database file to the name of the real database file. See
- *  the constants in db.h for required file names:
- *
- *         #define DB_FILE     "student.db"        //name of database file
- *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *  The database is compressed by copying only the pages holding live
+ *  records into a new file, at the same offsets, so the deleted records
+ *  become holes and the trailing deleted records are dropped.  The new
+ *  file is built in an anonymous O_TMPFILE in the database directory, so a
+ *  crash during the copy leaves nothing behind.  Filesystems without
+ *  O_TMPFILE fall back to the visible tmp_db_path() file.
  *
- *  Note that you are passed in the fd of the database file to be compressed,
- *  it is very likely you will need to close it to overwrite it with the
- *  compressed version of the file.  To ensure the caller can work with the
- *  compressed file after you create it, it is a good design to return the fd
- *  of the new compressed file from this function
+ *  The copy runs while other sdbsc processes keep writing.  The change log
+ *  position is noted before the copy, and afterwards, holding the log lock
+ *  (see log_begin()) so no new writer can start, every change made since
+ *  is replayed onto the copy before it is synced and linked into place.
+ *  The new file is opened onto the same fd number, so fd stays valid.
  *
  *  returns:  <number>       returns the fd of the compressed database file
- *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_FILE    database file I/O issue, fd is left untouched
+ *            ERR_DB_OP      the database is in the compact format
  *
  *
  *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
  *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
- *                             this error should also be returned after you
- *                             compressed the database file and if you are unable
- *                             to open it to pass the fd back to the caller
  *            M_ERR_DB_CREATE  error creating the db file. For instance the
  *                             inability to copy the temporary file back as
  *                             the primary database file.
  *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
- *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *            M_ERR_DB_COMPACT the database is in the compact format
  *
  */
-int compress_db(int fd)
+int compress_db(int fd, char *dbFile)
 {
-    // TODO
-    printf(M_NOT_IMPL);
+    char dir[PATH_BUF_SZ];
+    char tmp[PATH_BUF_SZ];
+    const char *base = strrchr(dbFile, '/');
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    unsigned long long seq;
+    bool anon = true;
+    off_t end;
+    int tmp_fd;
+    int rc;
+
+    // Compact databases have no deleted records to drop
+    if (db_is_compact(fd))
+    {
+        printf(M_ERR_DB_COMPACT);
+        return ERR_DB_OP;
+    }
+
+    if (base == NULL)
+        snprintf(dir, sizeof(dir), ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(base - dbFile) + 1, dbFile);
+    tmp_db_path(dbFile, tmp, sizeof(tmp));
+
+    seq = log_seq(fd);
+    tmp_fd = open(dir, O_TMPFILE | O_RDWR, mode);
+    if (tmp_fd < 0)
+    {
+        anon = false;
+        tmp_fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, mode);
+    }
+    if (tmp_fd < 0)
+    {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    if (copy_live_pages(fd, tmp_fd, &end) != NO_ERROR || ftruncate(tmp_fd, end) == -1)
+    {
+        printf(M_ERR_DB_READ);
+        rc = ERR_DB_FILE;
+    }
+    else if ((rc = log_begin(fd)) == NO_ERROR)
+    {
+        // writers are held off from here until the new file is in place
+        if (log_catch_up(fd, tmp_fd, &seq) != NO_ERROR || fsync(tmp_fd) == -1 ||
+            link_db(tmp_fd, anon, tmp, dbFile, dir) != NO_ERROR ||
+            dup2(tmp_fd, fd) == -1)
+        {
+            printf(M_ERR_DB_CREATE);
+            rc = ERR_DB_FILE;
+        }
+        // the names of the deleted students drop out of the name filter
+        else if (bloom_rebuild(fd, dbFile) != NO_ERROR)
+        {
+            printf(M_ERR_BLOOM, dbFile);
+            rc = ERR_DB_FILE;
+        }
+        log_end(fd);
+    }
+
+    if (rc != NO_ERROR && !anon)
+        unlink(tmp);
+    close(tmp_fd);
+    if (rc != NO_ERROR)
+        return rc;
+
+    printf(M_DB_COMPRESSED_OK);
     return fd;
 }
 
@@ -516,6 +794,9 @@ int validate_range(int id, int gpa)
     return NO_ERROR;
 }
 
+// libsdb is built from these sources without the command line, see libsdb.h
+#ifndef SDB_LIB
+
 /*
  *  usage
  *      exename:  the name of the executable from argv[0]
@@ -529,15 +810,31 @@ int validate_range(int id, int gpa)
  */
 void usage(char *exename)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s -[h|a|c|d|f|F|i|n|q|p|t|K|E|S|D|L|R|x|z] options.  Where:\n", exename);
     printf("\t-h:  prints help\n");
-    printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-a id first_name last_name gpa(as 3 digit int) [--unique]:  adds a student\n");
+    printf("\t                 (--unique refuses a name that is already in the database)\n");
     printf("\t-c:  counts the records in the database\n");
     printf("\t-d id:  deletes a student\n");
     printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-n first_name last_name:  finds and prints the students with a name\n");
+    printf("\t-q term ... [--explain]:  prints the students matching all of id=N[-M] gpa=N[-M]\n");
+    printf("\t                 fname=NAME[*] lname=NAME[*] (--explain prints the access plan)\n");
+    printf("\t-F [id_file] [--qd=N] [--pread]:  finds many students, ids read from id_file or stdin\n");
+    printf("\t-i [--cache=KB]:  runs the commands read from stdin (add, find, del, count, print, stats, quit)\n");
     printf("\t-p:  prints all records in the student database\n");
+    printf("\t-p --sort=lname|fname|gpa [--desc] [--mem=KB]:  prints all records sorted\n");
+    printf("\t-t K [--by gpa]:  prints the top K students\n");
+    printf("\t-K:  converts the database to the read only compact format\n");
+    printf("\t-E:  expands a compact database back to the slot format\n");
+    printf("\t-S n [dir ...]:  splits the database into n shards by id range\n");
+    printf("\t-D archive:  dumps the database to a portable archive file (- for stdout)\n");
+    printf("\t-L archive:  replaces the database with the contents of an archive (- for stdin)\n");
+    printf("\t-R primary_dir [--once] [--interval=ms]:  keeps this directory's database a replica of primary_dir\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
     printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t--mmap | --prefault:  after any option, full scans read a memory mapping of the db\n");
+    printf("\t                      (--prefault populates it up front and asks for huge pages)\n");
 }
 
 // Welcome to main()
@@ -545,16 +842,25 @@ int main(int argc, char *argv[])
 {
     char opt;      // user selected option
     int fd;        // file descriptor of database files
+    int add_fd;    // the database or shard -a adds to
     int rc;        // return code from various operations
     int exit_code; // exit code to shell
     int id;        // userid from argv[2]
     int gpa;       // gpa from argv[5]
+    int cache_kb;  // slot cache budget for -i
 
     // space for a student structure which we will get back from
     // some of the functions we will be writing such as get_student(),
     // and print_student().
     student_t student = {0};
 
+    // if the database is sharded this holds the shards, see sdb_shard.h
+    shard_set_t shards;
+
+    // name of the file behind fd, its change log and name filter live next
+    // to it
+    char *db_path = NULL;
+
     // This function must have at least one arg, and the arg must start
     // with a dash
     if ((argc < 2) || (*argv[1] != '-'))
@@ -563,6 +869,21 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    // --mmap and --prefault pick how full scans read the database and may
+    // follow any option, take them out before the option is handled
+    for (int i = 2; i < argc; i++)
+    {
+        int flags = (strcmp(argv[i], "--mmap") == 0)     ? MMAP_SCAN
+                    : (strcmp(argv[i], "--prefault") == 0) ? MMAP_PREFAULT
+                                                           : 0;
+        if (flags == 0)
+            continue;
+        mmap_scan_mode(mmap_scan_flags() | flags);
+        memmove(&argv[i], &argv[i + 1], (argc - i) * sizeof(char *));
+        argc--;
+        i--;
+    }
+
     // The option is the first character after the dash for example
     //-h -a -c -d -f -p -x -z
     opt = (char)*(argv[1] + 1); // get the option flag
@@ -574,13 +895,117 @@ int main(int argc, char *argv[])
         exit(EXIT_OK);
     }
 
+    // a shard manifest means the database is split over several files
+    if (load_shards(SHARD_MANIFEST, &shards) < 0)
+    {
+        printf(M_ERR_SHARD_MANIFEST);
+        exit(EXIT_FAIL_DB);
+    }
+
+    // splitting the database into shards happens before anything is opened
+    if (opt == 'S')
+    {
+        //    arv[0] arv[1]  arv[2]   arv[3..]
+        // prog_name     -S       n  [dir ...]
+        //-------------------------------------
+        // example:  prog_name -S 4 /disk1/sdb /disk2/sdb
+        int n = (argc >= 3) ? atoi(argv[2]) : 0;
+        if (n < 1 || n > SHARD_MAX)
+        {
+            usage(argv[0]);
+            exit(EXIT_FAIL_ARGS);
+        }
+        rc = create_shards(n, argv + 3, argc - 3);
+        exit((rc < 0) ? EXIT_FAIL_DB : EXIT_OK);
+    }
+
+    // a replica opens its own database, and never the shards
+    if (opt == 'R')
+    {
+        //    arv[0] arv[1]        arv[2]   arv[3..]
+        // prog_name     -R   primary_dir  [--once] [--interval=ms]
+        //----------------------------------------------------------
+        // example:  prog_name -R /mnt/primary/sdb --interval=200
+        bool once = false;
+        int interval = REPL_DEF_INTERVAL;
+        bool bad_args = (argc < 3 || shards.n != 0);
+        for (int i = 3; i < argc && !bad_args; i++)
+        {
+            if (strcmp(argv[i], "--once") == 0)
+                once = true;
+            else if (strncmp(argv[i], "--interval=", 11) == 0 && atoi(argv[i] + 11) > 0)
+                interval = atoi(argv[i] + 11);
+            else
+                bad_args = true;
+        }
+        if (bad_args)
+        {
+            usage(argv[0]);
+            exit(EXIT_FAIL_ARGS);
+        }
+        rc = replicate(argv[2], once, interval);
+        exit((rc < 0) ? EXIT_FAIL_DB : EXIT_OK);
+    }
+
     // now lets open the file and continue if there is no error
     // note we are not truncating the file using the second
-    // parameter
-    fd = open_db(DB_FILE, false);
-    if (fd < 0)
+    // parameter.  For a sharded database point operations open only the
+    // shard that owns the id, everything else opens all of the shards.
+    if (shards.n == 0)
     {
-        exit(EXIT_FAIL_DB);
+        fd = open_db(DB_FILE, false);
+        if (fd < 0)
+        {
+            exit(EXIT_FAIL_DB);
+        }
+        db_path = DB_FILE;
+    }
+    else if (strchr("adf", opt) != NULL && argc >= 3 && !(opt == 'a' && argc == 7))
+    {
+        id = atoi(argv[2]);
+        shard_t *sh = shard_for_id(&shards, id);
+        if (sh == NULL && validate_range(id, MIN_STD_GPA) == NO_ERROR)
+        {
+            printf(M_ERR_SHARD_NONE, id);
+            exit(EXIT_FAIL_DB);
+        }
+        // ids out of range fall through to the normal range checks
+        db_path = (sh != NULL) ? sh->path : shards.shards[0].path;
+        fd = open_db(db_path, false);
+        if (fd < 0)
+        {
+            exit(EXIT_FAIL_DB);
+        }
+        shards.n = 0;
+    }
+    else
+    {
+        if (open_shards(&shards) != NO_ERROR)
+        {
+            exit(EXIT_FAIL_DB);
+        }
+        fd = -1; // every operation below uses the shard fds
+    }
+
+    // changes made by -a, -d, -i and -z go to the change log as well, -x
+    // uses it to catch up with the writes made while it runs, and -K, -E
+    // and -L hold its lock to keep writers out while the database is
+    // replaced.  New names are added to the name filter (if there is one)
+    // and -n reads it.
+    if (strchr("adinxzKEL", opt) != NULL)
+    {
+        rc = NO_ERROR;
+        for (int i = 0; i < shards.n && rc == NO_ERROR; i++)
+            rc = log_attach(shards.shards[i].fd, shards.shards[i].path);
+        if (rc != NO_ERROR || (fd >= 0 && log_attach(fd, db_path) != NO_ERROR))
+        {
+            printf(M_ERR_LOG_WRITE);
+            exit(EXIT_FAIL_DB);
+        }
+        for (int i = 0; i < shards.n; i++)
+            bloom_attach(shards.shards[i].fd, shards.shards[i].path);
+        if (fd >= 0)
+            bloom_attach(fd, db_path);
     }
 
     // set rc to the return code of the operation to ensure the program
@@ -591,11 +1016,11 @@ int main(int argc, char *argv[])
     switch (opt)
     {
     case 'a':
-        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
-        // prog_name     -a      id  first_name last_name     gpa
-        //-------------------------------------------------------
+        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]     arv[6]
+        // prog_name     -a      id  first_name last_name     gpa [--unique]
+        //--------------------------------------------------------------------
         // example:  prog_name -a 1 John Doe 341
-        if (argc != 6)
+        if (argc != 6 && (argc != 7 || strcmp(argv[6], "--unique") != 0))
         {
             usage(argv[0]);
             exit_code = EXIT_FAIL_ARGS;
@@ -606,6 +1031,7 @@ int main(int argc, char *argv[])
         // they are valid numbers
         id = atoi(argv[2]);
         gpa = atoi(argv[5]);
+        add_fd = fd;
 
         exit_code = validate_range(id, gpa);
         if (exit_code == EXIT_FAIL_ARGS)
@@ -614,7 +1040,55 @@ int main(int argc, char *argv[])
             break;
         }
 
-        rc = add_student(fd, id, argv[3], argv[4], gpa);
+        // -a --unique on a sharded database opened all of the shards, the
+        // student still goes to the one that owns the id
+        if (shards.n > 0)
+        {
+            shard_t *sh = shard_for_id(&shards, id);
+            if (sh == NULL)
+            {
+                printf(M_ERR_SHARD_NONE, id);
+                exit_code = EXIT_FAIL_DB;
+                break;
+            }
+            add_fd = sh->fd;
+        }
+
+        // an online compaction (-x) swaps the file only between writes.
+        // --unique locks every shard, in id order, so the name cannot be
+        // added to another shard while they are searched
+        rc = NO_ERROR;
+        for (int i = 0; i < shards.n && rc == NO_ERROR; i++)
+            rc = log_begin(shards.shards[i].fd);
+        if (shards.n == 0)
+            rc = log_begin(fd);
+
+        // --unique refuses a second student with the same name, the name
+        // filter answers that without a scan for almost every new name
+        if (rc == NO_ERROR && argc == 7)
+        {
+            int found = 0;
+
+            for (int i = 0; i < shards.n && rc >= 0; i++)
+            {
+                rc = find_by_name(shards.shards[i].fd, shards.shards[i].path,
+                                  argv[3], argv[4], NULL);
+                found += (rc > 0) ? rc : 0;
+            }
+            if (shards.n == 0)
+                rc = found = find_by_name(fd, db_path, argv[3], argv[4], NULL);
+            if (rc >= 0 && found > 0)
+            {
+                printf(M_ERR_DB_ADD_NAME, argv[3], argv[4]);
+                rc = ERR_DB_OP;
+            }
+        }
+        if (rc == NO_ERROR)
+            rc = add_student(add_fd, id, argv[3], argv[4], gpa);
+        for (int i = 0; i < shards.n; i++)
+            log_end(shards.shards[i].fd);
+        if (shards.n == 0)
+            log_end(fd);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
@@ -625,7 +1099,10 @@ int main(int argc, char *argv[])
         // prog_name     -c
         //-----------------
         // example:  prog_name -c
-        rc = count_db_records(fd);
+        if (shards.n > 0)
+            rc = count_shards(&shards);
+        else
+            rc = count_db_records(fd);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
@@ -642,7 +1119,10 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
-        rc = del_student(fd, id);
+        rc = log_begin(fd);
+        if (rc == NO_ERROR)
+            rc = del_student(fd, id);
+        log_end(fd);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
@@ -678,14 +1158,311 @@ int main(int argc, char *argv[])
         }
         break;
 
+    case 'n':
+        //    arv[0] arv[1]      arv[2]     arv[3]
+        // prog_name     -n  first_name  last_name
+        //-----------------------------------------
+        // example:  prog_name -n John Doe
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        // id counts the students printed across all shards
+        id = 0;
+        rc = 0;
+        for (int i = 0; i < shards.n && rc >= 0; i++)
+            rc = find_by_name(shards.shards[i].fd, shards.shards[i].path,
+                              argv[2], argv[3], &id);
+        if (shards.n == 0)
+            rc = find_by_name(fd, DB_FILE, argv[2], argv[3], &id);
+        if (rc < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+        }
+        else if (id == 0)
+        {
+            printf(M_STD_NAME_NOT_FND, argv[2], argv[3]);
+            exit_code = EXIT_FAIL_DB;
+        }
+        break;
+
+    case 'q':
+        //    arv[0] arv[1]  arv[2..]
+        // prog_name     -q  term ... [--explain]
+        //----------------------------------------
+        // example:  prog_name -q id=100-200 lname=Sm* --explain
+        {
+            query_t q;
+            bool explain;
+            if (argc < 3 || parse_query(argv + 2, argc - 2, &q, &explain) != NO_ERROR)
+            {
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+            // id counts the students printed across all shards
+            id = 0;
+            rc = run_query(fd, &shards, &q, explain, &id);
+            if (rc < 0)
+            {
+                printf(M_ERR_DB_READ);
+                exit_code = EXIT_FAIL_DB;
+            }
+            else if (id == 0 && !explain)
+            {
+                printf(M_QUERY_NONE);
+                exit_code = EXIT_FAIL_DB;
+            }
+        }
+        break;
+
+    case 'D':
+        //    arv[0] arv[1]   arv[2]
+        // prog_name     -D  archive
+        //--------------------------
+        // example:  prog_name -D /backup/student.sdba
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = dump_db(fd, &shards, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'L':
+        //    arv[0] arv[1]   arv[2]
+        // prog_name     -L  archive
+        //--------------------------
+        // example:  prog_name -L /backup/student.sdba
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (shards.n > 0)
+        {
+            printf(M_ERR_ARCH_SHARDED);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        rc = log_begin(fd);
+        if (rc == NO_ERROR)
+            rc = restore_db(fd, DB_FILE, argv[2]);
+        log_end(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'i':
+        //    arv[0] arv[1]        arv[2]
+        // prog_name     -i  [--cache=KB]
+        //-------------------------------
+        // example:  printf 'add 1 john doe 345\nfind 1\n' | prog_name -i
+        cache_kb = CACHE_DEF_KB;
+        if (argc == 3 && strncmp(argv[2], "--cache=", 8) == 0)
+            cache_kb = atoi(argv[2] + 8);
+        else if (argc != 2)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = run_session(fd, &shards, stdin, cache_kb);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'F':
+        //    arv[0] arv[1]     arv[2..]
+        // prog_name     -F  [id_file] [--qd=N] [--pread]
+        //-----------------------------------------------
+        // example:  prog_name -F ids.txt --qd=128
+        // example:  cut -f1 roster.txt | prog_name -F
+        {
+            FILE *ids = stdin;
+            char *id_file = NULL;
+            int qdepth = BATCH_DEF_QDEPTH;
+            int flags = 0;
+
+            for (int i = 2; i < argc; i++)
+            {
+                if (strncmp(argv[i], "--qd=", 5) == 0)
+                    qdepth = atoi(argv[i] + 5);
+                else if (strcmp(argv[i], "--pread") == 0)
+                    flags |= BATCH_FORCE_PREAD;
+                else if (id_file == NULL && *argv[i] != '-')
+                    id_file = argv[i];
+                else
+                {
+                    exit_code = EXIT_FAIL_ARGS;
+                    break;
+                }
+            }
+            if (exit_code == EXIT_FAIL_ARGS || qdepth < 1)
+            {
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+
+            if (id_file != NULL && (ids = fopen(id_file, "r")) == NULL)
+            {
+                printf(M_ERR_ID_FILE, id_file);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+
+            rc = find_students(fd, &shards, ids, qdepth, flags);
+            if (rc < 0)
+                printf(M_ERR_DB_READ);
+            if (rc != 0)
+                exit_code = EXIT_FAIL_DB;
+
+            if (ids != stdin)
+                fclose(ids);
+        }
+        break;
+
     case 'p':
         //    arv[0] arv[1]
         // prog_name     -p
         //-----------------
         // example:  prog_name -p
-        rc = print_db(fd);
-        if (rc < 0)
-            exit_code = EXIT_FAIL_DB;
+        //
+        //    arv[0] arv[1]       arv[2]   arv[3]     arv[4]
+        // prog_name     -p  --sort=key  [--desc] [--mem=KB]
+        //----------------------------------------------------
+        // example:  prog_name -p --sort=gpa --desc
+        if (argc == 2)
+        {
+            if (shards.n > 0)
+                rc = print_shards(&shards);
+            else
+                rc = print_db(fd);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        {
+            int key = SORT_BY_ID;
+            bool desc = false;
+            long mem_kb = SORT_DEF_MEM_KB;
+
+            for (int i = 2; i < argc; i++)
+            {
+                if (strncmp(argv[i], "--sort=", 7) == 0)
+                    key = parse_sort_key(argv[i] + 7);
+                else if (strcmp(argv[i], "--desc") == 0)
+                    desc = true;
+                else if (strncmp(argv[i], "--mem=", 6) == 0)
+                    mem_kb = atol(argv[i] + 6);
+                else
+                    key = ERR_DB_OP;
+            }
+            if (key < 0 || mem_kb < SORT_MIN_MEM_KB)
+            {
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+
+            int fds[SHARD_MAX];
+            int nfds = 0;
+
+            if (shards.n == 0)
+                fds[nfds++] = fd;
+            for (int i = 0; i < shards.n; i++)
+                fds[nfds++] = shards.shards[i].fd;
+
+            rc = print_db_sorted(fds, nfds, key, desc, (size_t)mem_kb * 1024);
+            if (rc < 0)
+            {
+                printf(M_ERR_DB_READ);
+                exit_code = EXIT_FAIL_DB;
+            }
+        }
+        break;
+
+    case 't':
+        //    arv[0] arv[1]  arv[2]  arv[3]  arv[4]
+        // prog_name     -t       K   [--by     gpa]
+        //------------------------------------------
+        // example:  prog_name -t 100 --by gpa
+        {
+            int k = (argc >= 3) ? atoi(argv[2]) : 0;
+            int key = SORT_BY_GPA;
+
+            if (argc == 5 && strcmp(argv[3], "--by") == 0)
+                key = parse_sort_key(argv[4]);
+            else if (argc != 3)
+                key = ERR_DB_OP;
+
+            if (k < 1 || k > TOPK_MAX || key < 0)
+            {
+                usage(argv[0]);
+                exit_code = EXIT_FAIL_ARGS;
+                break;
+            }
+
+            if (shards.n > 0)
+                rc = top_k_shards(&shards, k, key);
+            else
+                rc = print_top_k(fd, k, key);
+            if (rc < 0)
+            {
+                printf(M_ERR_DB_READ);
+                exit_code = EXIT_FAIL_DB;
+            }
+        }
+        break;
+
+    case 'K':
+        //    arv[0] arv[1]
+        // prog_name     -K
+        //-----------------
+        // example:  prog_name -K
+        //
+        // like -L, each file is rewritten under its change log lock so no
+        // concurrent add or delete is lost, the new file keeps the fd
+        for (int i = 0; i < shards.n; i++)
+        {
+            shard_t *sh = &shards.shards[i];
+            if (log_begin(sh->fd) != NO_ERROR || compact_db(sh->fd, sh->path) < 0)
+                exit_code = EXIT_FAIL_DB;
+            log_end(sh->fd);
+        }
+        if (shards.n == 0)
+        {
+            if (log_begin(fd) != NO_ERROR || compact_db(fd, DB_FILE) < 0)
+                exit_code = EXIT_FAIL_DB;
+            log_end(fd);
+        }
+        break;
+
+    case 'E':
+        //    arv[0] arv[1]
+        // prog_name     -E
+        //-----------------
+        // example:  prog_name -E
+        for (int i = 0; i < shards.n; i++)
+        {
+            shard_t *sh = &shards.shards[i];
+            if (log_begin(sh->fd) != NO_ERROR || expand_db(sh->fd, sh->path) < 0)
+                exit_code = EXIT_FAIL_DB;
+            log_end(sh->fd);
+        }
+        if (shards.n == 0)
+        {
+            if (log_begin(fd) != NO_ERROR || expand_db(fd, DB_FILE) < 0)
+                exit_code = EXIT_FAIL_DB;
+            log_end(fd);
+        }
         break;
 
     case 'x':
@@ -694,10 +1471,15 @@ int main(int argc, char *argv[])
         //-----------------
         // example:  prog_name -x
 
-        // remember compress_db returns a fd of the compressed database.
-        // we close it after this switch statement
-        fd = compress_db(fd);
-        if (fd < 0)
+        // compress_db reopens the compressed database on the same fd, we
+        // close it after this switch statement
+        for (int i = 0; i < shards.n; i++)
+        {
+            shard_t *sh = &shards.shards[i];
+            if (compress_db(sh->fd, sh->path) < 0)
+                exit_code = EXIT_FAIL_DB;
+        }
+        if (shards.n == 0 && compress_db(fd, DB_FILE) < 0)
             exit_code = EXIT_FAIL_DB;
         break;
 
@@ -706,15 +1488,16 @@ int main(int argc, char *argv[])
         // prog_name     -x
         //-----------------
         // example:  prog_name -x
-        // HINT:  close the db file, we already have fd
-        //       and reopen db indicating truncate=true
-        close(fd);
-        fd = open_db(DB_FILE, true);
-        if (fd < 0)
+        // HINT:  truncate under the change log lock, the fd stays open
+        for (int i = 0; i < shards.n; i++)
         {
+            if (zero_db(shards.shards[i].fd, shards.shards[i].path) != NO_ERROR)
+                exit_code = EXIT_FAIL_DB;
+        }
+        if (shards.n == 0 && zero_db(fd, db_path) != NO_ERROR)
             exit_code = EXIT_FAIL_DB;
+        if (exit_code == EXIT_FAIL_DB)
             break;
-        }
         printf(M_DB_ZERO_OK);
         exit_code = EXIT_OK;
         break;
@@ -725,6 +1508,10 @@ int main(int argc, char *argv[])
 
     // dont forget to close the file before exiting, and setting the
     // proper exit code - see the header file for expected values
-    close(fd);
+    if (fd >= 0)
+        close(fd);
+    close_shards(&shards);
     exit(exit_code);
 }
+
+#endif
@@ -1,16 +1,43 @@
 #ifndef __SDB_H__
+    #define __SDB_H__
+
+#include <stdio.h>
+#include <stdbool.h>
 
 #include "db.h" //get student record type
 
+//see sdb_shard.h
+struct shard_set;
+
+//callback for scan_db(), called once per live student record.  Returning
+//anything other than NO_ERROR stops the scan and that value is returned
+//by scan_db()
+typedef int (*scan_fn)(const student_t *s, void *ctx);
+
+//scan_db() reads the database this many bytes at a time instead of one
+//record per read() call
+#define SCAN_BLOCK_SZ   (64 * 1024)
+
+//size of buffers used to build database file paths
+#define PATH_BUF_SZ     4096
+
+//compress_db() keeps or drops the database a file system page at a time
+#define COMPRESS_PAGE_SZ 4096
+
 //prototypes for functions go below for this assignment
 int open_db(char *dbFile, bool should_truncate);
+int zero_db(int fd, const char *dbFile);
+void tmp_db_path(const char *dbFile, char *buff, size_t len);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
+int find_students(int fd, const struct shard_set *shards, FILE *ids, int qdepth, int flags);
 int del_student(int fd, int id);
-int compress_db(int fd);
+int compress_db(int fd, char *dbFile);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
 int count_db_records(int fd);
+int scan_db(int fd, scan_fn fn, void *ctx);
+int count_record(const student_t *s, void *ctx);
 int print_db(int fd);
 void usage(char *);
 
@@ -23,6 +50,12 @@ void usage(char *);
 #define ERR_DB_FILE     -1
 #define ERR_DB_OP       -2
 #define SRCH_NOT_FOUND  -3
+//finer grained codes returned by the libsdb functions (see libsdb.h).
+//add_student() and del_student() print them and return ERR_DB_OP
+#define ERR_DB_RANGE    -4  //id or gpa out of the range in db.h
+#define ERR_DB_EXISTS   -5  //a student with the id is already in the db
+#define ERR_DB_READONLY -6  //add or delete on a compact database
+#define ERR_DB_LOG      -7  //the change was made but could not be logged
 #define NOT_IMPLEMENTED_YET 0
 
 
@@ -44,6 +77,7 @@ void usage(char *);
 #define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
 #define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
 #define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
+#define M_ERR_ID_FILE     "Error opening id file %s, exiting!\n"
 
 #define M_STD_ADDED       "Student %d added to database.\n"
 #define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
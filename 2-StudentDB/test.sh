@@ -6,6 +6,7 @@ setup_file() {
     if [ -f "student.db" ]; then
         rm "student.db"
     fi
+    rm -f "student.db.log" "student.db.bloom"
 }
 
 @test "Check if database is empty to start" {
@@ -192,4 +193,761 @@ setup_file() {
         echo "Failed Output:  $output"
         return 1
     }
-}
\ No newline at end of file
+}
+
+@test "Compress db keeps live records and leaves no temp file" {
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ ! -e .tmp_student.db ]
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Memory mapped scans match the block read scans" {
+    run ./sdbsc -p
+    plain_output="$output"
+
+    run ./sdbsc -p --mmap
+    [ "$status" -eq 0 ]
+    [ "$output" = "$plain_output" ]
+
+    run ./sdbsc -c --prefault
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Find students by name and refuse duplicate names" {
+    run ./sdbsc -n jane doe
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST NAME LAST NAME GPA 3 jane doe 3.90" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc -n nobody here
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No student named nobody here in database." ]
+
+    run ./sdbsc -a 70 jane doe 300 --unique
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant add student jane doe, the name already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Query planner picks an access path and filters" {
+    run ./sdbsc -q id=3 --explain
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "student.db: direct read of id 3." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -q id=1-100000 lname=d* gpa=300-400
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST NAME LAST NAME GPA 1 john doe 3.45 3 jane doe 3.90" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc -q id=4-10
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No students match the query." ]
+
+    run ./sdbsc -q gpa=600
+    [ "$status" -eq 2 ]
+}
+
+@test "Find many students with -F" {
+    run bash -c "printf '3 4\n1\n' | ./sdbsc -F --qd=1"
+    [ "$status" -eq 1 ]  || {
+        echo "Expecting status of 1, got:  $status"
+        return 1
+    }
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST NAME GPA 3 jane doe 3.90 Student 4 was not found in database. 1 john doe 3.45"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Print student records sorted by gpa descending" {
+    run ./sdbsc -p --sort=gpa --desc
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 3 jane doe 3.90 1 john doe 3.45 63 jim doe 2.85"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Print student records sorted by first name" {
+    run ./sdbsc -p --sort=fname
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 3 jane doe 3.90 63 jim doe 2.85 1 john doe 3.45"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Top 2 students by gpa" {
+    run ./sdbsc -t 2 --by gpa
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 3 jane doe 3.90 1 john doe 3.45"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Compact db format is readable and read only" {
+    run ./sdbsc -K
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database converted to compact format, 3 record(s) in 351 bytes." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+
+    run ./sdbsc -f 63
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "63 jim doe 2.85" ]
+
+    run ./sdbsc -a 2 too late 300
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Database is in compact format, expand it with -E first!" ]
+
+    run ./sdbsc -E
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database expanded to slot format, 3 record(s)." ]
+}
+
+@test "Sharded database routes point operations and merges scans" {
+    sdb="$PWD/sdbsc"
+    shard_dir=$(mktemp -d)
+    cd "$shard_dir"
+    mkdir disk1 disk2
+
+    run "$sdb" -a 10 low shard 300
+    run "$sdb" -a 90000 high shard 350
+    run "$sdb" -S 2 disk1 disk2
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database split into 2 shard(s), 2 record(s) moved." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ -f disk1/student.0.db ] && [ -f disk2/student.1.db ] && [ ! -f student.db ]
+    [ ! -f student.db.log ] && [ ! -f student.db.bloom ]
+
+    run "$sdb" -a 60000 mid shard 200
+    [ "$status" -eq 0 ]
+
+    run "$sdb" -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+
+    run "$sdb" -p
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST NAME LAST_NAME GPA 10 low shard 3.00 60000 mid shard 2.00 90000 high shard 3.50" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$shard_dir"
+}
+
+@test "Sharded database refuses a duplicate name from any shard" {
+    sdb="$PWD/sdbsc"
+    shard_dir=$(mktemp -d)
+    cd "$shard_dir"
+
+    run "$sdb" -a 10 low shard 300
+    run "$sdb" -a 90000 high shard 350
+    run "$sdb" -S 2
+    [ "$status" -eq 0 ]
+
+    run "$sdb" -a 90001 low shard 310 --unique
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant add student low shard, the name already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run "$sdb" -a 11 high shard 310 --unique
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant add student high shard, the name already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run "$sdb" -a 11 new shard 310 --unique
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 11 added to database." ]
+
+    run "$sdb" -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+
+    cd - > /dev/null
+    rm -rf "$shard_dir"
+}
+
+@test "Replica follows the primary change log" {
+    sdb="$PWD/sdbsc"
+    primary_dir=$(mktemp -d)
+    replica_dir=$(mktemp -d)
+
+    cd "$primary_dir"
+    run "$sdb" -a 1 first primary 300
+    run "$sdb" -a 2 second primary 310
+
+    cd "$replica_dir"
+    run "$sdb" -R "$primary_dir" --once
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Replica seeded from $primary_dir/student.db at sequence 2." ]
+
+    cd "$primary_dir"
+    run "$sdb" -d 1
+    run "$sdb" -a 70000 third primary 320
+
+    cd "$replica_dir"
+    run "$sdb" -R "$primary_dir" --once
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Replica at sequence 4, applied 2 change(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run "$sdb" -p
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST NAME LAST_NAME GPA 2 second primary 3.10 70000 third primary 3.20" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$primary_dir" "$replica_dir"
+}
+
+@test "Replica follows the primary across a restore" {
+    sdb="$PWD/sdbsc"
+    primary_dir=$(mktemp -d)
+    replica_dir=$(mktemp -d)
+
+    cd "$primary_dir"
+    run "$sdb" -a 1 first primary 300
+    run "$sdb" -a 2 second primary 310
+    run "$sdb" -D "$primary_dir/db.sdba"
+    [ "$status" -eq 0 ]
+
+    cd "$replica_dir"
+    run "$sdb" -R "$primary_dir" --once
+    [ "$status" -eq 0 ]
+
+    cd "$primary_dir"
+    run "$sdb" -d 2
+    run "$sdb" -a 3 third primary 320
+    run "$sdb" -L "$primary_dir/db.sdba"
+    [ "$status" -eq 0 ]
+
+    cd "$replica_dir"
+    run "$sdb" -R "$primary_dir" --once
+    [ "$status" -eq 0 ]
+
+    run "$sdb" -p
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST NAME LAST_NAME GPA 1 first primary 3.00 2 second primary 3.10" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$primary_dir" "$replica_dir"
+}
+
+@test "Session mode runs commands from stdin" {
+    sdb="$PWD/sdbsc"
+    session_dir=$(mktemp -d)
+    cd "$session_dir"
+
+    run bash -c "printf 'add 7 amy lee 380\nfind 7\nfind 8\nbogus\ncount\ndel 7\nquit\ncount\n' | '$sdb' -i"
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="Student 7 added to database. ID FIRST NAME LAST NAME GPA 7 amy lee 3.80 Student 8 was not found in database. Unknown or malformed command: bogus Database contains 1 student record(s). Student 7 was deleted from database."
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    run bash -c "printf 'add 7 amy lee 380\nfind 7\nfind 7\ndel 7\nfind 7\nstats\n' | '$sdb' -i --cache=64"
+    [ "$status" -eq 0 ]
+    [ "${lines[6]}" = "Student 7 was not found in database." ]
+    [ "${lines[7]}" = "Cache: 3 hit(s), 1 miss(es), 1 of 16 page(s) used." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$session_dir"
+}
+
+@test "Dump and restore round trip through an archive" {
+    sdb="$PWD/sdbsc"
+    src_dir=$(mktemp -d)
+    dst_dir=$(mktemp -d)
+
+    cd "$src_dir"
+    run "$sdb" -a 4 ann ray 310
+    run "$sdb" -a 80000 bob ray 220
+    run "$sdb" -D "$src_dir/db.sdba"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Dumped 2 record(s) to $src_dir/db.sdba." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    cd "$dst_dir"
+    run "$sdb" -L "$src_dir/db.sdba"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Restored 2 record(s) from $src_dir/db.sdba." ]
+
+    run "$sdb" -p
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST NAME LAST_NAME GPA 4 ann ray 3.10 80000 bob ray 2.20" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    # a damaged archive is refused and leaves the database alone
+    printf 'garbage' > "$src_dir/bad.sdba"
+    run "$sdb" -L "$src_dir/bad.sdba"
+    [ "$status" -eq 1 ]
+    run "$sdb" -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+
+    cd - > /dev/null
+    rm -rf "$src_dir" "$dst_dir"
+}
+
+@test "libsdb handles work without console output" {
+    src="$PWD"
+    lib_dir=$(mktemp -d)
+    cat > "$lib_dir/prog.c" <<'PROG'
+#include <stdio.h>
+#include "libsdb.h"
+
+int main(void)
+{
+    student_t recs[3] = {{5, "amy", "lee", 380}, {6, "bo", "kim", 250}, {5, "dup", "dup", 100}};
+    int ids[3] = {6, 7, 5};
+    int rcs[3];
+    student_t out[3];
+    sdb_t *db;
+
+    if (sdb_open("lib.db", SDB_OPEN_TRUNC, &db) != NO_ERROR)
+        return 1;
+    int n = sdb_add_many(db, recs, 3, rcs);
+    printf("added %d, dup rc %d\n", n, rcs[2]);
+    n = sdb_get_many(db, ids, 3, out, rcs);
+    printf("found %d, %s %d\n", n, out[0].fname, rcs[1]);
+    printf("del %d", sdb_del(db, 6));
+    printf(" %d", sdb_del(db, 6));
+    printf(", count %d\n", sdb_count(db));
+    printf("add %d\n", sdb_add(db, 0, "no", "id", 100));
+    sdb_close(db);
+    return 0;
+}
+PROG
+    gcc -I"$src" -o "$lib_dir/prog" "$lib_dir/prog.c" "$src/libsdb.a" -lpthread
+    cd "$lib_dir"
+    run ./prog
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "added 2, dup rc -5 found 2, bo -3 del 0 -3, count 1 add -4" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$lib_dir"
+}
+
+@test "A session adds names to a filter another process built" {
+    sdb="$PWD/sdbsc"
+    session_dir=$(mktemp -d)
+    cd "$session_dir"
+
+    # waits until the session has printed line $1 of its output
+    session_wait() {
+        for i in $(seq 1 100); do
+            [ "$(wc -l < session.out)" -ge "$1" ] && return 0
+            sleep 0.05
+        done
+        return 1
+    }
+
+    mkfifo cmds
+    "$sdb" -i < cmds > session.out &
+    exec 3> cmds
+    echo "count" >&3
+    session_wait 1
+    [ ! -f student.db.bloom ]
+
+    run "$sdb" -n nobody here
+    [ "$status" -eq 1 ]
+    [ -f student.db.bloom ]
+
+    echo "add 2 new name 310" >&3
+    session_wait 2
+    run "$sdb" -n new name
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "ID FIRST NAME LAST NAME GPA 2 new name 3.10" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    echo "quit" >&3
+    exec 3>&-
+    wait
+    cd - > /dev/null
+    rm -rf "$session_dir"
+}
+
+@test "A session cache sees changes made by another process" {
+    sdb="$PWD/sdbsc"
+    session_dir=$(mktemp -d)
+    cd "$session_dir"
+
+    session_wait() {
+        for i in $(seq 1 100); do
+            [ "$(wc -l < session.out)" -ge "$1" ] && return 0
+            sleep 0.05
+        done
+        return 1
+    }
+
+    "$sdb" -a 1 john doe 300 > /dev/null
+    mkfifo cmds
+    "$sdb" -i < cmds > session.out &
+    exec 3> cmds
+    printf 'find 1\nfind 1\n' >&3
+    session_wait 4
+
+    "$sdb" -d 1 > /dev/null
+    echo "find 1" >&3
+    session_wait 5
+    "$sdb" -a 1 jane roe 310 > /dev/null
+    printf 'find 1\nfind 1\nstats\nquit\n' >&3
+    exec 3>&-
+    wait
+
+    run cat session.out
+    [ "${lines[4]}" = "Student 1 was not found in database." ]
+    normalized_output=$(echo -n "${lines[6]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "1 jane roe 3.10" ]
+    [ "${lines[9]}" = "Cache: 2 hit(s), 3 miss(es), 1 of 64 page(s) used." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$session_dir"
+}
+
+@test "A session notices another process converted the database" {
+    sdb="$PWD/sdbsc"
+    session_dir=$(mktemp -d)
+    cd "$session_dir"
+
+    session_wait() {
+        for i in $(seq 1 100); do
+            [ "$(wc -l < session.out)" -ge "$1" ] && return 0
+            sleep 0.05
+        done
+        return 1
+    }
+
+    "$sdb" -a 1 john doe 300 > /dev/null
+    mkfifo cmds
+    "$sdb" -i < cmds > session.out &
+    exec 3> cmds
+    echo "find 1" >&3
+    session_wait 2
+
+    "$sdb" -K > /dev/null
+    printf 'add 2 jane roe 310\nfind 1\nquit\n' >&3
+    exec 3>&-
+    wait
+
+    run cat session.out
+    [ "${lines[2]}" = "Database is in compact format, expand it with -E first!" ]
+    normalized_output=$(echo -n "${lines[4]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "1 john doe 3.00" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$session_dir"
+}
+
+@test "A session reads the new file after another process runs -x" {
+    sdb="$PWD/sdbsc"
+    session_dir=$(mktemp -d)
+    cd "$session_dir"
+
+    session_wait() {
+        for i in $(seq 1 100); do
+            [ "$(wc -l < session.out)" -ge "$1" ] && return 0
+            sleep 0.05
+        done
+        return 1
+    }
+
+    "$sdb" -a 1 john doe 300 > /dev/null
+    "$sdb" -a 2 jane roe 310 > /dev/null
+    "$sdb" -d 2 > /dev/null
+    mkfifo cmds
+    "$sdb" -i < cmds > session.out &
+    exec 3> cmds
+    echo "find 1" >&3
+    session_wait 2
+
+    "$sdb" -x > /dev/null
+    "$sdb" -a 5 jim poe 320 > /dev/null
+    "$sdb" -d 1 > /dev/null
+    printf 'find 5\nfind 1\ncount\nquit\n' >&3
+    exec 3>&-
+    wait
+
+    run cat session.out
+    normalized_output=$(echo -n "${lines[3]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "5 jim poe 3.20" ]
+    [ "${lines[4]}" = "Student 1 was not found in database." ]
+    [ "${lines[5]}" = "Database contains 1 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$session_dir"
+}
+
+@test "Cache readers on several threads never see a torn record" {
+    src="$PWD"
+    lib_dir=$(mktemp -d)
+    cat > "$lib_dir/prog.c" <<'PROG'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "libsdb.h"
+#include "sdb_cache.h"
+
+#define READERS 4
+#define WRITES  1000000
+
+static int fd;
+static volatile int done;
+
+// every field of a record written here follows from its first name
+static void *writer(void *arg)
+{
+    student_t s = {5, "", "", 0};
+
+    for (int k = 1; k <= WRITES; k++)
+    {
+        snprintf(s.fname, sizeof(s.fname), "w%d", k);
+        snprintf(s.lname, sizeof(s.lname), "w%d", k);
+        s.gpa = k % 500;
+        cache_put(fd, 5, &s);
+    }
+    done = 1;
+    return arg;
+}
+
+// id 5 is hit, ids 100 and 200 keep evicting the other page of the cache
+static void *reader(void *arg)
+{
+    long *torn = arg;
+    int ids[3] = {5, 100, 5};
+    student_t s;
+
+    for (int i = 0; !done; i++)
+    {
+        int id = (i % 64 == 63) ? 200 : ids[i % 3];
+        if (cache_get(fd, id, &s) != NO_ERROR || s.id != id)
+            (*torn)++;
+        else if (id == 5 && (strcmp(s.fname, s.lname) != 0 || s.gpa != atoi(s.fname + 1) % 500))
+            (*torn)++;
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    student_t recs[3] = {{5, "w0", "w0", 0}, {100, "a", "b", 100}, {200, "c", "d", 200}};
+    pthread_t w, r[READERS];
+    long torn[READERS] = {0};
+    long total = 0;
+
+    fd = open("cache.db", O_RDWR | O_CREAT | O_TRUNC, 0600);
+    for (int i = 0; i < 3; i++)
+        if (fd < 0 || db_add(fd, &recs[i]) != NO_ERROR)
+            return 1;
+    if (cache_init(8) != NO_ERROR)
+        return 1;
+
+    for (int i = 0; i < READERS; i++)
+        pthread_create(&r[i], NULL, reader, &torn[i]);
+    pthread_create(&w, NULL, writer, NULL);
+    pthread_join(w, NULL);
+    for (int i = 0; i < READERS; i++)
+    {
+        pthread_join(r[i], NULL);
+        total += torn[i];
+    }
+    printf("torn %ld\n", total);
+    return 0;
+}
+PROG
+    gcc -I"$src" -o "$lib_dir/prog" "$lib_dir/prog.c" "$src/libsdb.a" -lpthread
+    cd "$lib_dir"
+    run ./prog
+    [ "$status" -eq 0 ]
+    [ "$output" = "torn 0" ] || {
+        echo "Failed Output: $output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$lib_dir"
+}
+
+@test "Threads open, write and close their own handles at once" {
+    src="$PWD"
+    lib_dir=$(mktemp -d)
+    cat > "$lib_dir/prog.c" <<'PROG'
+#include <stdio.h>
+#include <pthread.h>
+#include "libsdb.h"
+
+#define THREADS 4
+#define ROUNDS  2000
+
+static int done;
+
+// keeps one handle open, adds, reads back and deletes its own students
+static void *worker(void *arg)
+{
+    long *errors = arg;
+    int base = (int)(errors[1] * ROUNDS);
+    student_t s;
+    sdb_t *db;
+
+    if (sdb_open("threads.db", 0, &db) != NO_ERROR)
+    {
+        errors[0]++;
+        return NULL;
+    }
+    for (int k = 1; k <= ROUNDS; k++)
+    {
+        if (sdb_add(db, base + k, "thread", "round", 300) != NO_ERROR ||
+            sdb_get(db, base + k, &s) != NO_ERROR || s.id != base + k ||
+            (k % 2 == 0 && sdb_del(db, base + k) != NO_ERROR))
+            errors[0]++;
+    }
+    sdb_close(db);
+    return NULL;
+}
+
+// opens and closes handles the whole time, moving the others around
+static void *churn(void *arg)
+{
+    long *errors = arg;
+    sdb_t *db[3];
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE))
+    {
+        for (int i = 0; i < 3; i++)
+            if (sdb_open("threads.db", 0, &db[i]) != NO_ERROR)
+                errors[0]++;
+        for (int i = 0; i < 3; i++)
+            sdb_close(db[i]);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t t[THREADS + 1];
+    long errors[THREADS + 1][2];
+    long total = 0;
+    sdb_t *db[70];
+    int n = 0;
+
+    for (int i = 0; i <= THREADS; i++)
+    {
+        errors[i][0] = 0;
+        errors[i][1] = i;
+        pthread_create(&t[i], NULL, (i < THREADS) ? worker : churn, errors[i]);
+    }
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(t[i], NULL);
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    pthread_join(t[THREADS], NULL);
+    for (int i = 0; i <= THREADS; i++)
+        total += errors[i][0];
+
+    while (n < 70 && sdb_open("threads.db", 0, &db[n]) == NO_ERROR)
+        n++;
+    printf("errors %ld count %d handles %d\n", total, sdb_count(db[0]), n);
+    while (n > 0)
+        sdb_close(db[--n]);
+    return 0;
+}
+PROG
+    # under ThreadSanitizer, where the compiler has it, a race on the link
+    # tables fails the run even on a machine where it never goes wrong
+    if ! gcc -fsanitize=thread -DSDB_LIB -I"$src" -o "$lib_dir/prog" "$lib_dir/prog.c" \
+            "$src"/*.c -lpthread 2> /dev/null; then
+        gcc -I"$src" -o "$lib_dir/prog" "$lib_dir/prog.c" "$src/libsdb.a" -lpthread
+    fi
+    cd "$lib_dir"
+    export TSAN_OPTIONS=halt_on_error=1
+    run ./prog
+    [ "$status" -eq 0 ]
+    [ "$output" = "errors 0 count 4000 handles 65" ] || {
+        echo "Failed Output: $output"
+        return 1
+    }
+
+    cd - > /dev/null
+    rm -rf "$lib_dir"
+}